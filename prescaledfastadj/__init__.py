@@ -1,10 +1,24 @@
 
-from .core import AdjacencyCore
+from .core import AdjacencyCore, kmeans
 
 import numpy as np
 from scipy.sparse.linalg import eigsh, LinearOperator
 
-from .krylovschur import krylov_schur_eigs
+from .krylovschur import krylov_schur_eigs, resume_krylov_schur_eigs
+from .blockcg import block_cg
+from .multishift import multishift_cg
+from .preconditioner import WoodburyPreconditioner, pivoted_cholesky, nystrom
+from .slq import slq_logdet
+from .gradients import trace_inv_products
+from .diagonal import diag_inverse
+from .lowrank import LowRankOperator
+from .additive import AdditiveGP
+from .matfun import lanczos_matfun
+from .kpm import spectral_density, SpectralDensity
+from .randomized import randomized_range, randomized_eigh, randomized_nystrom
+from .loo import loo_cv, LOOScores
+from .slicing import slice_eigs, eigencount
+from .info import SolverInfo, StochasticEstimate, TimedOperator, timer
 
 from warnings import warn
 
@@ -39,6 +53,8 @@ class AdjacencyMatrix():
         self.setup = setup
         self.scaling_factor = 1
         self.core = None
+        self._eigenpairs = None
+        self._derivative = None
         
         self._sigma = sigma
         self._kernel = kernel
@@ -57,7 +73,8 @@ class AdjacencyMatrix():
     
     @kernel.setter
     def kernel(self, kernel):
-        self.core.kernel = kernel
+        self._kernel = kernel
+        self._rebuild_core()
     
     @property
     def d(self):
@@ -77,10 +94,20 @@ class AdjacencyMatrix():
     
     @sigma.setter
     def sigma(self, sigma):
-        points = self.core.points
+        # the nodes do not depend on sigma, only the kernel coefficients are recomputed
         self._sigma = sigma
+        self.core.sigma = self.scaling_factor * sigma
+        self._eigenpairs = None
+    
+    def _rebuild_core(self):
+        # a new core starts with an empty degree cache
+        points = self.core.points
+        diagonal = self.core.diagonal
         self._setup_core(points.shape[1])
         self.core.points = points
+        self.core.diagonal = diagonal
+        self._eigenpairs = None
+        self._derivative = None
     
     @property
     def scaled_points(self):
@@ -116,9 +143,13 @@ class AdjacencyMatrix():
                 radius*self.scaling_factor < 0.5*allowed_radius:
             self.scaling_factor = allowed_radius / radius
             
+            diagonal = 0.0 if self.core is None else self.core.diagonal
             self._setup_core(d)
+            self.core.diagonal = diagonal
             
         self.core.points = points * self.scaling_factor
+        self._eigenpairs = None
+        self._derivative = None
 
     @property
     def diagonal(self):
@@ -127,57 +158,424 @@ class AdjacencyMatrix():
     @diagonal.setter
     def diagonal(self, diag):
         self.core.diagonal = diag
+        self._eigenpairs = None
+
+    @property
+    def degrees(self):
+        # cached in the core until points, sigma, kernel or diagonal change
+        return self.core.degrees
+    
+    @property
+    def d_invsqrt(self):
+        return self.core.d_invsqrt
 
     def apply(self, v):
         return self.core.apply(v)
     
-    def normalized_eigs(self, k=6, method='krylov-schur', shift=1, one_shift=2, tol=None):
+    def apply_normalized(self, v, shift=0.0, sign=1.0):
+        return self.core.apply_normalized(v, shift, sign)
+    
+    def apply_laplacian(self, v, kind='sym'):
+        return self.core.apply_laplacian(v, kind)
+    
+    def submatrix(self, I, J=None):
+        """Exact block A[I, J] of the adjacency matrix (A[I, I] if J is None), evaluated 
+        with the same kernel and scaling as the core."""
+        return self.core.submatrix(I, J)
+    
+    def diag(self):
+        return self.core.diag()
+    
+    def apply_block(self, X, op='adjacency', shift=0.0, sign=1.0):
+        """Compute sign * M X + shift * X for the columns of X, two columns per transform."""
+        return self.core.apply_block(X, op, shift, sign)
+    
+    def solve(self, b, shift=0.0, op='adjacency', method='cg', rtol=1e-8, maxiter=None, x0=None, 
+              preconditioner=None, return_info=False):
+        """Solve (M + shift * I) x = b natively, where M is the adjacency matrix (default) 
+        or another symmetric operator ('normalized', 'sym' or 'unnormalized'). See solve."""
+        return solve(self.core, b, shift=shift, op=op, method=method, rtol=rtol, maxiter=maxiter, 
+                     x0=x0, preconditioner=preconditioner, return_info=return_info)
+    
+    def preconditioner(self, shift, rank=100, method='pivoted-cholesky', tol=1e-8, seed=None):
+        """Preconditioner for solve(b, shift) from a rank-r approximation L L^T of the 
+        adjacency matrix, built from exact kernel columns ('pivoted-cholesky' or 'nystrom' 
+        with uniformly sampled landmarks) and applied by the Woodbury identity. Requires
+        a positive semidefinite adjacency matrix, e.g. the Gaussian kernel with diagonal 1."""
+        if method == 'pivoted-cholesky':
+            L, _ = pivoted_cholesky(self.core.columns, self.core.diag(), rank, tol)
+        elif method == 'nystrom':
+            L, _ = nystrom(self.core.columns, self.n, rank, seed)
+        else:
+            raise ValueError("Unknown preconditioner method '{}' (expected 'pivoted-cholesky' or 'nystrom')".format(method))
+        return WoodburyPreconditioner(L, shift)
+    
+    def logdet(self, shift=0.0, op='adjacency', steps=30, rtol=1e-2, max_probes=200, block_size=8, 
+               confidence=0.95, seed=None):
+        """Stochastic Lanczos quadrature estimate of log det(M + shift * I) for the adjacency
+        matrix (default) or another symmetric operator, which must be positive definite.
+        Returns a StochasticEstimate with the estimate, its confidence interval and the 
+        matvec count."""
+        return slq_logdet(lambda V: self.core.apply_block(V, op, shift), self.n, steps=steps, rtol=rtol, 
+                          max_probes=max_probes, block_size=block_size, confidence=confidence, rng=seed)
+    
+    def gp_gradient(self, y, noise, num_probes=30, method='hutch++', rtol=1e-6, preconditioner=None, 
+                    confidence=0.95, seed=None):
+        """Stochastic gradient of the Gaussian process log marginal likelihood
+            log p(y) = -1/2 y^T K^{-1} y - 1/2 log det K - n/2 log(2 pi),   K = A + noise * I,
+        with respect to (sigma, noise) for the Gaussian (kernel 1) and Matérn(1/2) 
+        (kernel 3) kernels with diagonal 1. The derivative dA/dsigma is applied with the 
+        corresponding derivative kernel (2 or 4), whose fast summation nodes are set up 
+        on the first call and kept until the points or the kernel change. The traces 
+        tr(K^{-1} dK) of both components come from block CG solves shared by the probes 
+        and y (see trace_inv_products). Returns a StochasticEstimate of the gradient."""
+        if self.kernel not in (1, 3):
+            raise ValueError("AdjacencyMatrix.gp_gradient requires the Gaussian (1) or the Matérn(1/2) (3) kernel")
+        
+        # dK/dsigma = (2/sigma) xx_gaussian and (1/sigma) der_laplacian_rbf, respectively
+        derivative = self._derivative_core()
+        scale = 2/self.sigma if self.kernel == 1 else 1/self.sigma
+        dK_sigma = lambda V: scale * derivative.apply_block(V)
+        dK_noise = lambda V: V
+        K = lambda V: self.core.apply_block(V, 'adjacency', noise)
+        
+        solve_info = []
+        def solve(B):
+            X, info = block_cg(K, B, rtol=rtol, preconditioner=preconditioner, return_info=True)
+            if not info.converged:
+                warn("gp_gradient: block CG did not converge, largest relative residual {:.3g}".format(info.residuals[-1].max()))
+            solve_info.append(info)
+            return X
+        
+        traces, alpha = trace_inv_products(solve, [dK_sigma, dK_noise], self.n, num_probes, method, 
+                                           extra_rhs=y, rng=seed, confidence=confidence)
+        for info in solve_info:
+            traces.info.matvecs += info.matvecs
+            traces.info.iterations += info.iterations
+            traces.info.time_operator += info.time_operator
+        alpha = alpha[:,0]
+        quadratic = np.array([alpha @ dK_sigma(alpha[:,None])[:,0], alpha @ alpha])
+        return StochasticEstimate(0.5 * quadratic - 0.5 * traces.samples, confidence, traces.info)
+    
+    def _derivative_core(self):
+        # core of the derivative kernel on the same scaled nodes; setting sigma only
+        # recomputes its kernel coefficients
+        if self._derivative is None or self._derivative.kernel != self.kernel + 1:
+            self._derivative = AdjacencyCore(self.kernel + 1, self.d, self.core.sigma, 
+                                             self.setup.N, self.setup.p, self.setup.m, self.setup.eps)
+            self._derivative.points = self.core.points
+        elif self._derivative.sigma != self.core.sigma:
+            self._derivative.sigma = self.core.sigma
+        return self._derivative
+    
+    def probing_radius(self, tol=1e-2):
+        """Distance beyond which the kernel has decayed below tol, sigma sqrt(log(1/tol)) 
+        for the Gaussian and sigma log(1/tol) for the Matern(1/2) kernel."""
+        if self.kernel in (1, 2):
+            return self.sigma * np.sqrt(np.log(1/tol))
+        return self.sigma * np.log(1/tol)
+    
+    def _probing_colors(self, coloring, radius, tol):
+        if not coloring:
+            return None
+        radius = self.probing_radius(tol) if radius is None else radius
+        return self.core.distance_coloring(radius * self.scaling_factor)
+    
+    def diag_inverse(self, shift, num_probes=32, coloring=True, radius=None, rtol=1e-6, 
+                     preconditioner=None, block_size=32, confidence=0.95, seed=None, radius_tol=1e-2):
+        """Stochastic estimate of diag((A + shift * I)^{-1}), e.g. the posterior variances
+        of a Gaussian process, by probing with block CG solves. With coloring, the 
+        probes follow a greedy coloring of the nodes in which nodes of equal color are 
+        at least radius apart (default: where the kernel has decayed below radius_tol, 
+        see probing_radius). Probing needs num_probes of at least 4 times the number 
+        of colors, otherwise plain Hutchinson probes are used with a warning, see 
+        diagonal.diag_inverse. Returns a StochasticEstimate with per-entry standard 
+        errors and confidence intervals whose num_vectors is the number of solved 
+        probes and whose info holds the matvec count."""
+        colors = self._probing_colors(coloring, radius, radius_tol)
+        
+        def solve(B):
+            X, info = block_cg(lambda V: self.core.apply_block(V, 'adjacency', shift), B, rtol=rtol, 
+                               preconditioner=preconditioner, return_info=True)
+            if not info.converged:
+                warn("diag_inverse: block CG did not converge, largest relative residual {:.3g}".format(info.residuals[-1].max()))
+            return X, info
+        
+        return diag_inverse(solve, self.n, num_probes, colors, block_size=block_size, rng=seed, confidence=confidence)
+    
+    def loo_cv(self, y, shifts, num_probes=32, coloring=True, radius=None, rtol=1e-6, block_size=32, 
+               confidence=0.95, seed=None, radius_tol=1e-2):
+        """Approximate leave-one-out cross-validation scores of kernel ridge regression 
+        with A + shift * I for every given shift (regularization parameter lambda), 
+        with error bars. The weights and the diagonals of the inverses of all shifts 
+        come from multi-shift CG solves at the cost of the smallest shift, the 
+        diagonals by probing as in diag_inverse. To compare several sigma, set 
+        adj.sigma between the calls; this keeps the node precomputation. Returns 
+        LOOScores."""
+        colors = self._probing_colors(coloring, radius, radius_tol)
+        shift0 = np.min(shifts)
+        return loo_cv(lambda V: self.core.apply_block(V, 'adjacency', shift0), y, shifts, num_probes, colors, 
+                      rtol=rtol, block_size=block_size, rng=seed, confidence=confidence)
+    
+    def label_propagation(self, labels, tau=1.0, num_classes=None, rtol=1e-6, maxiter=None, return_info=False):
+        """Graph-based semi-supervised classification (label spreading, Zhou et al., 2004):
+        solve (I + tau * L_sym) U = F with one column of F per class, where F[i, c] = 1 
+        if node i is labeled with class c. labels is an integer array with -1 for 
+        unlabeled nodes, or the n x c matrix F itself. All classes are solved together 
+        by block CG with the fused operator, which uses the cached degrees.
+        
+        tau may be a sequence; the values are then solved in the given order, each 
+        warm-started from the solution of the previous one (ascending values are best). 
+        Returns the n x c class scores U (predictions: U.argmax(axis=1)), a list of 
+        them for a sequence of tau, and the SolverInfo(s) if return_info is True."""
+        labels = np.asarray(labels)
+        if labels.ndim == 1:
+            if num_classes is None:
+                num_classes = labels.max() + 1
+            F = (labels[:,None] == np.arange(num_classes)).astype(float)
+        else:
+            F = np.asarray(labels, dtype=float)
+        
+        taus = np.atleast_1d(tau)
+        U, scores, infos = None, [], []
+        for t in taus:
+            U, info = block_cg(lambda V: self.core.apply_block(V, 'sym', 1.0, t), F, rtol=rtol, maxiter=maxiter,
+                               X0=U, return_info=True)
+            if not info.converged:
+                warn("label_propagation: block CG did not converge for tau={:.3g}, largest relative residual {:.3g}".format(
+                     t, info.residuals[-1].max()))
+            scores.append(U)
+            infos.append(info)
+        
+        if np.ndim(tau) == 0:
+            scores, infos = scores[0], infos[0]
+        return (scores, infos) if return_info else scores
+    
+    def solve_shifts(self, b, shifts, op='adjacency', rtol=1e-8, maxiter=None, return_info=False):
+        """Solve (M + shift * I) x = b for a vector of shifts (e.g. regularization 
+        parameters lambda) with one multi-shift CG iteration, at the matvec cost of the 
+        smallest shift. Returns the n x len(shifts) array of solutions (and a SolverInfo)."""
+        shift0 = np.min(shifts)
+        X, info = multishift_cg(lambda v: self.core.apply_block(v[:,None], op, shift0)[:,0], b, shifts, 
+                                rtol=rtol, maxiter=maxiter, return_info=True)
+        if not info.converged:
+            warn("solve_shifts: multi-shift CG did not converge, largest relative residual {:.3g}".format(info.residuals[-1].max()))
+        return (X, info) if return_info else X
+    
+    def matfun_apply(self, f, v, op='adjacency', shift=0.0, maxiter=100, rtol=1e-8, check_every=5, 
+                     reorthogonalize=None, return_info=False):
+        """Lanczos approximation of f(M + shift * I) v for the adjacency matrix, the 
+        normalized adjacency matrix ('normalized') or the Laplacian ('sym' or 
+        'unnormalized'), e.g. exp(-t L) v for diffusion, (A + lambda I)^{1/2} z for 
+        sampling or (A + lambda I)^{-1/2} v for whitening. f acts on the eigenvalues; 
+        v may be an n x m block, and a list of functions (e.g. one per time t) reuses 
+        the same Krylov bases. Stops a posteriori once the result no longer changes by 
+        more than rtol. With reorthogonalize, the Krylov bases are stored, 8 n bytes per 
+        step and column; without it, at twice the products. The default stores them if 
+        they fit into 1 GiB at maxiter steps (see lanczos_matfun)."""
+        if op == 'rw':
+            raise ValueError("AdjacencyMatrix.matfun_apply requires a symmetric operator, use 'sym' instead of 'rw'")
+        return lanczos_matfun(lambda V: self.core.apply_block(V, op, shift), v, f, maxiter=maxiter, rtol=rtol,
+                              check_every=check_every, reorthogonalize=reorthogonalize, return_info=return_info)
+    
+    def normalized_eigs(self, k=6, method='krylov-schur', shift=1, one_shift=2, tol=None, return_info=False, callback=None,
+                        checkpoint=None, checkpoint_every=1):
         # return normalized_eigs(self.core, k, method, shift, one_shift, 
         #                        self.setup.eigs_tol if tol is None else tol)
         if shift != 1:
             warn("AdjacencyMatrix.normalized_eigs: argument 'shift' is deprecated and no longer used.", DeprecationWarning)
         if one_shift != 2:
             warn("AdjacencyMatrix.normalized_eigs: argument 'one_shift' is deprecated and no longer used.", DeprecationWarning)
-            
-        return normalized_eigs_wielandt(self.core, k=k, 
-                                        tol=self.setup.eigs_tol if tol is None else tol)
         
-
-
-    def normalized_laplacian_norm(self, tol=None):
         if tol is None:
             tol = self.setup.eigs_tol
-            
-        n = self.core.n
-        d_invsqrt = 1 / np.sqrt(self.core.apply(np.ones(n)))
         
-        def matvec(v):
-            return v - d_invsqrt * self.core.apply(d_invsqrt * v)
+        if method == 'krylov-schur':
+            result = normalized_eigs_wielandt(self.core, k=k, tol=tol, return_info=return_info, callback=callback,
+                                              checkpoint=checkpoint, checkpoint_every=checkpoint_every)
+        elif checkpoint is not None:
+            raise ValueError("AdjacencyMatrix.normalized_eigs: checkpointing is only supported for method 'krylov-schur'")
+        else:
+            result = normalized_eigs(self.core, k=k, method=method, tol=tol, return_info=return_info, callback=callback)
+        # kept for low_rank_operator until points, sigma, kernel or diagonal change
+        self._eigenpairs = (tol, result[0], result[1])
+        return result
+
+    
+    def spectral_clustering(self, k, num_eigs=None, tol=None, maxiter=300, kmeans_tol=1e-6, seed=0, 
+                            normalize=True):
+        """Spectral clustering (Ng, Jordan & Weiss, 2001) into k clusters: the num_eigs 
+        (default: k) largest eigenvectors of the normalized adjacency matrix, rows 
+        normalized to unit length, are clustered by the native multithreaded 
+        k-means++/Lloyd iteration, which reads the eigenvector matrix in place. 
+        Returns the labels and a dict with the time of every stage ('eigs', 
+        'kmeans', 'total'), the k-means inertia and number of iterations."""
+        tic_total = timer()
+        w, U = self.normalized_eigs(k if num_eigs is None else num_eigs, tol=tol)
+        time_eigs = timer() - tic_total
+        
+        tic = timer()
+        labels, _, inertia, iterations = kmeans(U, k, maxiter=maxiter, tol=kmeans_tol, seed=seed, normalize=normalize)
+        time_kmeans = timer() - tic
+        
+        return labels, {'eigs': time_eigs, 'kmeans': time_kmeans, 'total': timer() - tic_total,
+                        'inertia': inertia, 'iterations': iterations}
+    
+    def resume_normalized_eigs(self, checkpoint, return_info=False, callback=None, checkpoint_every=1):
+        """Continue an interrupted normalized_eigs computation from the checkpoint directory.
+        The points, sigma, kernel and diagonal must be the same as in the interrupted run."""
+        return normalized_eigs_wielandt(self.core, return_info=return_info, callback=callback,
+                                        checkpoint=checkpoint, checkpoint_every=checkpoint_every, resume=True)
+
+
+    def normalized_laplacian_norm(self, tol=None, method='lanczos', rtol=1e-3, return_info=False, maxiter=300, 
+                                  delta=1e-3, seed=None):
+        """Spectral norm of the symmetric normalized Laplacian. The default method 
+        'lanczos' (native Lanczos, see norm_bounds) stops once the norm is known to 
+        relative accuracy rtol with probability at least 1 - delta over the random 
+        start vector, which is drawn from np.random.default_rng(seed). The previous 
+        default 'arpack-scipy' (scipy's eigsh to tolerance tol, by default that of 
+        the accuracy setup) is still available; tol is rejected with 'lanczos'."""
+        info = SolverInfo(method)
+        tic = timer()
+        
+        if method == 'lanczos':
+            if tol is not None:
+                raise ValueError("normalized_laplacian_norm: tol applies to method 'arpack-scipy', "
+                                 "method 'lanczos' takes rtol")
+            seed = int(np.random.default_rng(seed).integers(2**63))
+            nrm, lower, upper, info.matvecs = self.core.lanczos_norm('sym', rtol, maxiter, seed=seed, delta=delta)
+            info.iterations = info.matvecs
+            info.residuals.append(upper - lower)
+            info.converged = bool(np.isfinite(upper) and upper - lower <= rtol * upper)
+        elif method == 'arpack-scipy':
+            if tol is None:
+                tol = self.setup.eigs_tol
+                
+            n = self.core.n
+            matvec = TimedOperator(self.core.apply_laplacian, info)
+            
+            nrm = eigsh(LinearOperator((n,n), dtype=np.float64, matvec=matvec),
+                        k = 1,
+                        which = 'LM',
+                        tol = tol,
+                        return_eigenvectors = False)[0]
+            info.converged = True
+        else:
+            raise ValueError("Unknown norm computation method: {}".format(method))
         
-        nrm = eigsh(LinearOperator((n,n), dtype=np.float64, matvec=matvec),
-                    k = 1,
-                    which = 'LM',
-                    tol = tol,
-                    return_eigenvectors = False)[0]
+        info.time_total = timer() - tic
         
+        if return_info:
+            return nrm, info
         return nrm
     
+    def norm_bounds(self, op='sym', rtol=1e-3, maxiter=100, delta=1e-3, seed=None):
+        """Lanczos estimate of the spectral norm of a symmetric operator ('adjacency', 
+        'normalized', 'sym' or 'unnormalized'). Returns (estimate, lower, upper, matvecs).
+        The lower bound (largest Ritz value) is deterministic; the upper bound is the 
+        Kuczynski-Wozniakowski bound for the random start vector, which fails with 
+        probability at most delta and is infinite after too few iterations. The start
+        vector is drawn from np.random.default_rng(seed), so that the failures of 
+        repeated calls are independent unless a seed is given."""
+        seed = int(np.random.default_rng(seed).integers(2**63))
+        return self.core.lanczos_norm(op, rtol, maxiter, seed=seed, delta=delta)
+    
+    def laplacian_eigs(self, k=6, kind='sym', method='krylov-schur', tol=None):
+        return laplacian_eigs(self.core, k=k, kind=kind, method=method,
+                              tol=self.setup.eigs_tol if tol is None else tol)
+    
+    def low_rank_operator(self, k=6, tol=None, batch_size=256):
+        """Rank-k surrogate U diag(w) U^T of the normalized adjacency matrix from its k 
+        largest eigenpairs. The eigenpairs of the last normalized_eigs call are reused 
+        if there are at least k+1 of them computed to tol; otherwise k+1 are computed. 
+        The discarded eigenvalues lie between normalized_lower_bound() and the 
+        (k+1)-th largest one, which bounds the spectral norm of the discarded part 
+        (truncation_error) without a further eigensolve; the residual norm of the 
+        k+1 computed eigenpairs (one block product) is added for their inaccuracy."""
+        tol = self.setup.eigs_tol if tol is None else tol
+        if self._eigenpairs is None or len(self._eigenpairs[1]) <= k or self._eigenpairs[0] > tol:
+            self.normalized_eigs(k+1, tol=tol)
+        _, w, U = self._eigenpairs
+        residual = np.linalg.norm(self.core.apply_block(U[:,:k+1], 'normalized') - U[:,:k+1] * w[:k+1], 2)
+        return LowRankOperator(w[:k], U[:,:k], max(abs(w[k]), -self.normalized_lower_bound()) + residual, batch_size)
+    
+    def normalized_lower_bound(self):
+        """Lower bound of the spectrum of the normalized adjacency matrix. For the 
+        Gaussian and Matern(1/2) kernels, A = K + (diagonal - 1) I with a positive 
+        semidefinite K, so the bound is (diagonal - 1) / min(degrees) (at most 0); 
+        otherwise it is -1."""
+        if self.kernel in (1, 3):
+            return max(-1.0, min(0.0, (self.diagonal - 1) / self.degrees.min()))
+        return -1.0
+    
+    def randomized_low_rank(self, op='adjacency', shift=0.0, tol=1e-2, method='eigh', block_size=10, 
+                            max_rank=500, power_iters=1, seed=None, return_info=False):
+        """Randomized low-rank factorization M + shift * I ~ U diag(w) U^T from block 
+        products, without an eigensolver. The rank grows by block_size until the 
+        estimated relative Frobenius error is below tol. method 'eigh' (range finder 
+        and Rayleigh-Ritz) works for any symmetric operator, 'nystrom' requires a 
+        positive semidefinite one (e.g. the Gaussian kernel with diagonal 1) and is 
+        more accurate at the same rank. Returns a LowRankOperator (and a SolverInfo)."""
+        operator = lambda V: self.core.apply_block(V, op, shift)
+        if method == 'eigh':
+            factorize = randomized_eigh
+        elif method == 'nystrom':
+            factorize = randomized_nystrom
+        else:
+            raise ValueError("Unknown factorization '{}' (expected 'eigh' or 'nystrom')".format(method))
+        return factorize(operator, self.n, tol=tol, block_size=block_size, max_rank=max_rank, 
+                         power_iters=power_iters, rng=seed, return_info=return_info)
+    
+    def normalized_eigencount(self, a, b, degree=None, num_vectors=20):
+        """Stochastic estimate of the number of eigenvalues of the normalized adjacency
+        matrix, whose spectrum lies in [-1, 1], in [a, b] (degree/2 block products). 
+        Returns (estimate, standard error, bias); the bias estimates the leakage of the 
+        Jackson smoothing at the ends of [a, b] and is not included in the standard 
+        error, see eigencount."""
+        return eigencount(lambda V: self.core.apply_block(V, 'normalized'), self.n, a, b, -1.0, 1.0, 
+                          degree=degree, num_vectors=num_vectors)
+    
+    def normalized_density(self, degree=200, num_probes=40, block_size=8, bounds=(-1.0, 1.0), confidence=0.95, 
+                           seed=None):
+        """Kernel polynomial method estimate of the eigenvalue density of the normalized 
+        adjacency matrix, whose spectrum lies in bounds = [-1, 1], from degree stochastic 
+        Chebyshev moments of num_probes block probes (about degree/2 block products per 
+        block of probes). The returned SpectralDensity provides density(x), 
+        count(a, b), cumulative(x) and histogram(bins) without further products."""
+        return spectral_density(lambda V: self.core.apply_block(V, 'normalized'), self.n, bounds[0], bounds[1],
+                                degree=degree, num_probes=num_probes, block_size=block_size, 
+                                confidence=confidence, rng=seed)
+    
+    def normalized_eigs_interval(self, a, b, tol=None, degree=None, count=None, num_vectors=20,
+                                 maxiter=50, return_info=False, callback=None):
+        """All eigenpairs of the normalized adjacency matrix with eigenvalues in [a, b], 
+        in descending order, without computing the eigenvalues above b."""
+        return slice_eigs(lambda V: self.core.apply_block(V, 'normalized'), self.n, a, b, -1.0, 1.0, 
+                          tol=self.setup.eigs_tol if tol is None else tol, degree=degree, count=count, 
+                          num_vectors=num_vectors, maxiter=maxiter, return_info=return_info, callback=callback)
+    
 
-def normalized_eigs_wielandt(core, k=6, tol=0):
+def normalized_eigs_wielandt(core, k=6, tol=0, return_info=False, callback=None, 
+                             checkpoint=None, checkpoint_every=1, resume=False):
     n = core.n
-    u1 = np.sqrt(np.maximum(core.apply(np.ones(n)), 0.0))
-    
-    d_invsqrt = np.zeros(n)
-    d_invsqrt[u1 > tol] = 1 / u1[u1 > tol]
+    u1 = np.sqrt(np.maximum(core.degrees, 0.0))
     
     u1 /= np.linalg.norm(u1)
     u1 = u1[:,None]
     
-    if k == 1:
-        return np.array([1.0]), u1
+    if k == 1 and not resume:
+        info = SolverInfo('krylov-schur')
+        info.converged = True
+        return (np.array([1.0]), u1, info) if return_info else (np.array([1.0]), u1)
 
-    matvec = lambda v: d_invsqrt * core.apply(d_invsqrt * v) + v
-    w, U = krylov_schur_eigs(matvec, n, k=k-1, tol=tol, W=u1)
+    matvec = lambda v: core.apply_normalized(v, 1.0)
+    if resume:
+        w, U, info = resume_krylov_schur_eigs(matvec, checkpoint, return_info=True, callback=callback, 
+                                              checkpoint_every=checkpoint_every)
+    else:
+        w, U, info = krylov_schur_eigs(matvec, n, k=k-1, tol=tol, W=u1, return_info=True, callback=callback,
+                                       checkpoint=checkpoint, checkpoint_every=checkpoint_every)
 
     ind = np.argsort(-w)
     w = w[ind] - 1
@@ -186,26 +584,155 @@ def normalized_eigs_wielandt(core, k=6, tol=0):
     w = np.hstack((1.0, w))
     U = np.hstack((u1, U))
     
+    if return_info:
+        return w, U, info
     return w, U
 
 
 
-def normalized_eigs(core, k=6, method='krylov-schur', shift=1, one_shift=2, tol=0):
-    n = core.n
-    u1 = np.sqrt(np.maximum(core.apply(np.ones(n)), 0.0))
+def solve(core, b, shift=0.0, op='adjacency', method='cg', rtol=1e-8, maxiter=None, x0=None, 
+          preconditioner=None, return_info=False):
+    """Solve (M + shift * I) x = b with the native preconditioned CG ('cg', for positive 
+    definite systems such as kernel ridge regression) or MINRES ('minres', for 
+    indefinite systems, e.g. with the derivative kernels). The preconditioner is None, 
+    a vector p applied as p * r, or a callable returning an approximation of the 
+    inverse applied to r; it must be positive definite and a callable must not use 
+    the same AdjacencyMatrix. maxiter defaults to 10 n, but at most 10000. Returns 
+    x, or (x, info) with a SolverInfo if return_info is True.
+    
+    If b is an n x m array, the m systems are solved together by block CG (see 
+    block_cg), with the preconditioner applied to n x m blocks."""
+    if np.ndim(b) == 2:
+        if method != 'cg':
+            raise ValueError("solve: multiple right-hand sides require method 'cg'")
+        X, info = block_cg(lambda P: core.apply_block(P, op, shift), b, rtol=rtol, maxiter=maxiter, X0=x0,
+                           preconditioner=preconditioner, return_info=True)
+        if not info.converged:
+            warn("solve: block CG did not converge, largest relative residual {:.3g}".format(info.residuals[-1].max()))
+        return (X, info) if return_info else X
+    
+    x, stats = core.solve(b, op=op, shift=shift, method=method, rtol=rtol, maxiter=maxiter or 0, 
+                          x0=x0, preconditioner=preconditioner)
+    
+    if not stats['converged']:
+        reason = 'breakdown' if stats['breakdown'] else 'maximum number of iterations reached'
+        warn("solve: {} did not converge ({}), relative residual {:.3g}".format(method, reason, stats['residual_norm']))
+    
+    if not return_info:
+        return x
+    
+    info = SolverInfo(method)
+    info.matvecs = stats['matvecs']
+    info.iterations = stats['iterations']
+    info.converged = stats['converged']
+    info.residuals = list(stats['residuals'])
+    info.time_operator = stats['time_operator']
+    info.time_precond = stats['time_precond']
+    info.time_total = stats['time_total']
+    info.time_orth = info.time_total - info.time_operator - info.time_precond
+    return x, info
+
+
+def additive_gp(points, y, windows, sigma=1.0, signal=1.0, noise=0.1, kernel=1, setup='default', **options):
+    """Set up an AdditiveGP for the additive kernel sum_w s_w A_w + noise * I over the
+    feature windows (lists of column indices of the prescaled points). sigma and 
+    signal are scalars or one value per window. The adjacency matrices of the windows
+    and of their derivative kernels are built once here; the time goes to the 
+    'setup' phase of the timings. Further keyword options are passed to AdditiveGP."""
+    tic = timer()
+    sigma = np.broadcast_to(np.asarray(sigma, dtype=float), (len(windows),))
+    matrices, derivatives = [], []
+    for window, s in zip(windows, sigma):
+        window_points = np.ascontiguousarray(points[:, window])
+        matrices.append(AdjacencyMatrix(window_points, s, kernel, setup=setup, diagonal=1.0))
+        derivatives.append(AdjacencyMatrix(window_points, s, kernel + 1, setup=setup))
     
-    d_invsqrt = np.zeros(n)
-    d_invsqrt[u1 > tol] = 1 / u1[u1 > tol]
+    gp = AdditiveGP(matrices, derivatives, y, kernel, signal=signal, noise=noise, **options)
+    gp.timings['setup'] += timer() - tic
+    return gp
+
+
+def fit_additive_gp(points, y, windows, sigma=1.0, signal=1.0, noise=0.1, kernel=1, setup='default', 
+                    maxiter=50, tol=1e-4, bounds=None, **options):
+    """Train the per-window sigmas and signal variances and the noise of an additive
+    Gaussian process by maximizing the estimated log marginal likelihood (see 
+    additive_gp and AdditiveGP.fit). Returns the trained AdditiveGP and the 
+    optimization result, which includes the time spent in every phase."""
+    gp = additive_gp(points, y, windows, sigma, signal, noise, kernel, setup, **options)
+    result = gp.fit(maxiter=maxiter, tol=tol, bounds=bounds)
+    return gp, result
+
+
+def has_arpack():
+    """Whether the core extension has been built with the native ARPACK backend."""
+    return hasattr(AdjacencyCore, 'normalized_eigs')
+
+
+def arpack_eigs(core, k=6, op='normalized', tol=0, deflate=None, shift=1.0, sign=1.0):
+    """Native ARPACK eigensolver over a fused operator, computing the largest 
+    eigenvalues of sign * M + shift * I. With deflate=(value, vector), the known 
+    eigenpair is removed by Wielandt deflation inside the iteration and prepended 
+    to the result. Returns the eigenvalues of M in descending order of 
+    sign * M, the eigenvectors and a SolverInfo with the ARPACK iteration statistics."""
+    if not has_arpack():
+        raise ValueError("Eigenvalue computation method 'arpack' has not been built (set ARPACK_BASE before running setup)")
+    
+    info = SolverInfo('arpack')
+    
+    if deflate is not None:
+        if k == 1:
+            info.converged = True
+            return np.array([deflate[0]]), deflate[1], info
+        k -= 1
+    
+    w, U, stats = core.normalized_eigs(k, tol=tol, deflate=deflate is not None, op=op, shift=shift, sign=sign)
+    
+    # ARPACK counts implicit restarts as iterations
+    info.matvecs = stats['matvecs']
+    info.restarts = stats['iterations']
+    info.reorth_passes = stats['reorthogonalizations']
+    info.converged = stats['converged'] >= k and not stats['maxiter_reached']
+    info.time_operator = stats['time_operator']
+    info.time_total = stats['time_total']
+    info.time_orth = info.time_total - info.time_operator
+    
+    ind = np.argsort(-sign*w)
+    w = w[ind]
+    U = U[:, ind]
+    
+    if deflate is not None:
+        w = np.hstack((deflate[0], w))
+        U = np.hstack((deflate[1], U))
+    
+    return w, U, info
+
+
+def normalized_eigs_arpack(core, k=6, tol=0):
+    u1 = np.sqrt(np.maximum(core.degrees, 0.0))
+    u1 /= np.linalg.norm(u1)
+    
+    return arpack_eigs(core, k=k, op='normalized', tol=tol, deflate=(1.0, u1[:,None]))
+
+
+
+def normalized_eigs(core, k=6, method='krylov-schur', shift=1, one_shift=2, tol=0, return_info=False, callback=None):
+    if method in ('arpack', 'arpack-fortran'):
+        # the native backend always uses Wielandt deflation instead of shifts
+        w, U, info = normalized_eigs_arpack(core, k=k, tol=tol)
+        return (w, U, info) if return_info else (w, U)
+    
+    n = core.n
+    u1 = np.sqrt(np.maximum(core.degrees, 0.0))
     
     u1 /= np.linalg.norm(u1)
     
     if k == 1:
-        return np.array([1.0]), u1[:, np.newaxis]
+        info = SolverInfo(method)
+        info.converged = True
+        return (np.array([1.0]), u1[:, np.newaxis], info) if return_info else (np.array([1.0]), u1[:, np.newaxis])
 
     def matvec(v):
-        w = d_invsqrt * core.apply(d_invsqrt * v)
-        if shift != 0:
-            w += shift*v
+        w = core.apply_normalized(v, shift)
         if one_shift != 0:
             w -= one_shift * (u1 @ v) * u1
         return w
@@ -213,17 +740,15 @@ def normalized_eigs(core, k=6, method='krylov-schur', shift=1, one_shift=2, tol=
     if one_shift != 0:
         k -= 1
     
-    if method == 'arpack-fortran':
-        if not hasattr(core, 'normalized_eigs'):
-            raise ValueError("Eigenvalue computation method 'arpack-fortran' has not been built")
-        if shift != 0 or one_shift != 0:
-            raise ValueError("Eigenvalue computation method 'arpack-fortran' is incompatible with shifts")
-        w, U = core.normalized_eigs(k, tol=tol)
-    elif method == 'arpack-scipy':
-        operator = LinearOperator((n,n), dtype=np.float64, matvec=matvec)
+    if method == 'arpack-scipy':
+        info = SolverInfo(method)
+        tic = timer()
+        operator = LinearOperator((n,n), dtype=np.float64, matvec=TimedOperator(matvec, info))
         w, U = eigsh(operator, k=k, which='LA' if shift == 0 else 'LM', tol=tol)
+        info.time_total = timer() - tic
+        info.converged = True
     elif method == 'krylov-schur':
-        w, U = krylov_schur_eigs(matvec, n, k=k, tol=tol)
+        w, U, info = krylov_schur_eigs(matvec, n, k=k, tol=tol, return_info=True, callback=callback)
     else:
         raise ValueError("Unknown eigenvalue computation method: {}".format(method))
         
@@ -237,4 +762,63 @@ def normalized_eigs(core, k=6, method='krylov-schur', shift=1, one_shift=2, tol=
         w = np.hstack((1.0, w))
         U = np.hstack((u1[:,np.newaxis], U))
     
+    if return_info:
+        return w, U, info
+    return w, U
+
+
+
+def laplacian_eigs(core, k=6, kind='sym', method='krylov-schur', tol=0):
+    """Compute the k smallest eigenvalues of the graph Laplacian of the given kind
+    ('sym': I - D^{-1/2} A D^{-1/2}, 'rw': I - D^{-1} A, 'unnormalized': D - A)
+    and the corresponding (right) eigenvectors, sorted by increasing eigenvalue."""
+    n = core.n
+    
+    if kind in ('sym', 'rw'):
+        # L_sym = I - N shares its eigenvectors with the normalized adjacency N,
+        # and L_rw = D^{-1/2} L_sym D^{1/2} has the eigenvectors D^{-1/2} U
+        if method == 'krylov-schur':
+            w, U = normalized_eigs_wielandt(core, k=k, tol=tol)
+        else:
+            w, U = normalized_eigs(core, k=k, method=method, tol=tol)
+        w = 1 - w
+        if kind == 'rw':
+            U = core.d_invsqrt[:,None] * U
+            U /= np.linalg.norm(U, axis=0)
+        return w, U
+    
+    if kind != 'unnormalized':
+        raise ValueError("Unknown Laplacian kind: {}".format(kind))
+    
+    # (D - A) 1 = 0, so deflate the constant vector and compute the largest
+    # eigenvalues of c*I - L with c >= |lambda| for all eigenvalues of L
+    u1 = np.full((n,1), 1/np.sqrt(n))
+    if k == 1:
+        return np.array([0.0]), u1
+    
+    c = 2 * np.abs(core.degrees).max()
+    
+    if method == 'arpack':
+        w, U, _ = arpack_eigs(core, k=k, op='unnormalized', tol=tol, deflate=(0.0, u1), shift=c, sign=-1.0)
+        return w, U
+    elif method == 'krylov-schur':
+        matvec = lambda v: core.apply_laplacian(v, 'unnormalized', c, -1.0)
+        w, U = krylov_schur_eigs(matvec, n, k=k-1, tol=tol, W=u1)
+    elif method == 'arpack-scipy':
+        def matvec(v):
+            v = v - u1[:,0] * (u1[:,0] @ v)
+            w = core.apply_laplacian(v, 'unnormalized', c, -1.0)
+            return w - u1[:,0] * (u1[:,0] @ w)
+        operator = LinearOperator((n,n), dtype=np.float64, matvec=matvec)
+        w, U = eigsh(operator, k=k-1, which='LA', tol=tol)
+    else:
+        raise ValueError("Unknown eigenvalue computation method: {}".format(method))
+    
+    ind = np.argsort(-w)
+    w = c - w[ind]
+    U = U[:, ind]
+    
+    w = np.hstack((0.0, w))
+    U = np.hstack((u1, U))
+    
     return w, U
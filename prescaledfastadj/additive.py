@@ -0,0 +1,211 @@
+
+import numpy as np
+from scipy.optimize import minimize, OptimizeResult
+
+from .blockcg import block_cg
+from .preconditioner import WoodburyPreconditioner, pivoted_cholesky
+from .slq import lanczos_quadrature, rademacher
+from .gradients import trace_inv_products
+from .info import timer
+
+from warnings import warn
+
+
+
+class AdditiveGP:
+    """Gaussian process with the additive kernel
+
+        K = sum_w s_w A_w(sigma_w) + noise * I
+
+    over feature windows, where A_w is the Gaussian (kernel 1) or Matérn(1/2)
+    (kernel 3) adjacency matrix with diagonal 1 of the features of window w and
+    s_w is its signal variance. matrices and derivatives are the AdjacencyMatrix
+    objects of A_w and of the corresponding derivative kernels (2 or 4). They are
+    set up once; changing sigma_w only recomputes the kernel coefficients of the
+    fast summation, the nodes are kept across all evaluations.
+
+    The negative log marginal likelihood
+        1/2 y^T K^{-1} y + 1/2 log det K   (without the constant n/2 log(2 pi))
+    is estimated by stochastic Lanczos quadrature for the log-determinant and one
+    block CG solve, optionally with a pivoted Cholesky preconditioner, for y and
+    the trace probes of the gradient (see trace_inv_products). The
+    log-determinant and the traces tr(K^{-1} dK) of its gradient use the same
+    logdet_probes Rademacher probes (with trace_method 'hutch++', num_probes // 3
+    further vectors sketch the traced products), drawn from the same seed in
+    every evaluation, so the objective is a smooth function of the parameters and
+    the errors of objective and gradient are strongly correlated.
+
+    The estimated gradient is nevertheless not the exact derivative of the
+    estimated objective: per probe, z^T K^{-1} dK z differs from the derivative of
+    the quadrature estimate of z^T log(K) z, and both differ from their
+    expectations. Near the optimum, where the true gradient is small, a line
+    search can therefore fail to find descent; fit reports this.
+
+    The wall-clock time of every phase is accumulated in self.timings."""
+
+    phases = ('setup', 'kernel', 'preconditioner', 'solve', 'logdet', 'gradient', 'optimizer')
+
+    def __init__(self, matrices, derivatives, y, kernel, signal=1.0, noise=0.1, num_probes=30,
+                 trace_method='hutchinson', logdet_probes=32, steps=30, rtol=1e-6, preconditioner_rank=0,
+                 seed=0):
+        if kernel not in (1, 3):
+            raise ValueError("AdditiveGP requires the Gaussian (1) or the Matérn(1/2) (3) kernel")
+        self.matrices = matrices
+        self.derivatives = derivatives
+        self.y = np.asarray(y, dtype=float)
+        self.kernel = kernel
+        self.n = len(self.y)
+        self.signal = np.broadcast_to(np.asarray(signal, dtype=float), (len(matrices),)).copy()
+        self.noise = float(noise)
+
+        self.num_probes = num_probes
+        self.trace_method = trace_method
+        self.logdet_probes = logdet_probes
+        self.steps = steps
+        self.rtol = rtol
+        self.preconditioner_rank = preconditioner_rank
+        self.seed = seed
+
+        self.timings = dict.fromkeys(self.phases, 0.0)
+        self.history = []
+        self.alpha = None
+
+    @property
+    def num_windows(self):
+        return len(self.matrices)
+
+    @property
+    def sigma(self):
+        return np.array([A.sigma for A in self.matrices])
+
+    @property
+    def params(self):
+        """All parameters (sigma_1, ..., sigma_W, s_1, ..., s_W, noise)."""
+        return np.concatenate([self.sigma, self.signal, [self.noise]])
+
+    @params.setter
+    def params(self, params):
+        W = self.num_windows
+        tic = timer()
+        for A, dA, sigma in zip(self.matrices, self.derivatives, params[:W]):
+            if sigma != A.sigma:
+                A.sigma = sigma
+                dA.sigma = sigma
+        self.timings['kernel'] += timer() - tic
+        self.signal = np.array(params[W:2*W], dtype=float)
+        self.noise = float(params[2*W])
+
+    def apply(self, V, noise=True):
+        """K V (or K V - noise * V) for an n x m block V."""
+        KV = self.noise * V if noise else np.zeros_like(V)
+        for s, A in zip(self.signal, self.matrices):
+            KV += s * A.core.apply_block(V)
+        return KV
+
+    def preconditioner(self):
+        """Woodbury preconditioner from a pivoted Cholesky factorization of the
+        kernel part, built from exact columns, or None if preconditioner_rank is 0."""
+        if self.preconditioner_rank == 0:
+            return None
+        tic = timer()
+        columns = lambda J: sum(s * A.core.columns(J) for s, A in zip(self.signal, self.matrices))
+        diagonal = sum(s * A.core.diag() for s, A in zip(self.signal, self.matrices))
+        L, _ = pivoted_cholesky(columns, diagonal, self.preconditioner_rank)
+        P = WoodburyPreconditioner(L, self.noise)
+        self.timings['preconditioner'] += timer() - tic
+        return P
+
+    def objective(self, params=None):
+        """Negative log marginal likelihood and its gradient with respect to the
+        parameters (sigma_1, ..., sigma_W, s_1, ..., s_W, noise)."""
+        if params is not None:
+            self.params = params
+        preconditioner = self.preconditioner()
+        K = lambda V: self.apply(V)
+
+        tic = timer()
+        rng = np.random.default_rng(self.seed)
+        Z = rademacher(rng, self.n, self.logdet_probes)
+        rules = lanczos_quadrature(K, Z, self.steps)
+        if min(theta.min() for theta, _ in rules) <= 0:
+            raise ValueError("AdditiveGP: the kernel matrix is not positive definite")
+        logdet = np.mean([weights @ np.log(theta) for theta, weights in rules])
+        self.timings['logdet'] += timer() - tic
+
+        # dK/dsigma = (2/sigma) xx_gaussian and (1/sigma) der_laplacian_rbf, respectively
+        def dK_sigma(s, A, dA):
+            scale = s * (2/A.sigma if self.kernel == 1 else 1/A.sigma)
+            return lambda V: scale * dA.core.apply_block(V)
+        derivatives = [dK_sigma(s, A, dA) for s, A, dA in zip(self.signal, self.matrices, self.derivatives)]
+        derivatives += [A.core.apply_block for A in self.matrices]
+        derivatives += [lambda V: V]
+
+        solve_time = []
+        def solve(B):
+            tic = timer()
+            X, info = block_cg(K, B, rtol=self.rtol, preconditioner=preconditioner, return_info=True)
+            if not info.converged:
+                warn("AdditiveGP: block CG did not converge, largest relative residual {:.3g}".format(info.residuals[-1].max()))
+            solve_time.append(timer() - tic)
+            return X
+
+        tic = timer()
+        traces, alpha = trace_inv_products(solve, derivatives, self.n, self.num_probes, self.trace_method,
+                                           extra_rhs=self.y, rng=rng, probes=Z)
+        self.alpha = alpha[:,0]
+        quadratic = np.array([self.alpha @ dK(self.alpha[:,None])[:,0] for dK in derivatives])
+        self.timings['solve'] += solve_time[0]
+        self.timings['gradient'] += timer() - tic - solve_time[0]
+
+        nll = 0.5 * self.y @ self.alpha + 0.5 * logdet
+        gradient = 0.5 * traces.estimate - 0.5 * quadratic
+        self.history.append((self.params, nll, gradient))
+        return nll, gradient
+
+    def fit(self, maxiter=50, tol=1e-4, bounds=None, callback=None):
+        """Minimize the negative log marginal likelihood with L-BFGS-B over the
+        logarithms of the parameters. bounds is an optional list of (lower, upper)
+        pairs for the parameters themselves (None for no bound). Returns the
+        scipy OptimizeResult with the fitted sigma, signal and noise, the number of
+        evaluations and the per-phase timings added. line_search_failed tells
+        whether L-BFGS-B stopped because its line search found no decrease, which
+        happens when the stochastic gradient does not match the estimated
+        objective (see AdditiveGP); a warning is issued then."""
+        tic_total = timer()
+        inner = lambda: sum(self.timings[p] for p in self.phases[1:-1])
+        before = inner()
+
+        def fun(theta):
+            params = np.exp(theta)
+            nll, gradient = self.objective(params)
+            return nll, gradient * params
+
+        log_bounds = None
+        if bounds is not None:
+            log_bounds = [(None if lo is None else np.log(lo), None if hi is None else np.log(hi)) for lo, hi in bounds]
+
+        result = minimize(fun, np.log(self.params), jac=True, method='L-BFGS-B', bounds=log_bounds, tol=tol,
+                          options={'maxiter': maxiter}, callback=callback)
+        self.params = np.exp(result.x)
+        line_search_failed = not result.success and 'LNSRCH' in str(result.message)
+        if line_search_failed:
+            warn("AdditiveGP.fit: the L-BFGS-B line search failed after {} evaluations ({}); the stochastic gradient "
+                 "may be too inaccurate, try more logdet_probes".format(result.nfev, result.message))
+
+        self.timings['optimizer'] += timer() - tic_total - (inner() - before)
+        result = OptimizeResult(result)
+        result.sigma, result.signal, result.noise = self.sigma, self.signal.copy(), self.noise
+        result.evaluations = len(self.history)
+        result.line_search_failed = line_search_failed
+        result.timings = dict(self.timings)
+        return result
+
+    def posterior_mean(self):
+        """Posterior mean sum_w s_w A_w alpha of the latent function at the training
+        points for the weights alpha = K^{-1} y of the last evaluation."""
+        if self.alpha is None:
+            self.objective()
+        return self.apply(self.alpha[:,None], noise=False)[:,0]
+
+    def __repr__(self):
+        return "AdditiveGP(n={}, windows={}, kernel={}, noise={:.3g})".format(self.n, self.num_windows, self.kernel, self.noise)
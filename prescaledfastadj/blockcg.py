@@ -0,0 +1,117 @@
+
+import numpy as np
+from scipy.linalg import qr, solve, LinAlgError
+
+from .info import SolverInfo, timer
+
+
+
+def _orth(Z, rank_tol):
+    """Orthonormal basis of the numerical range of Z by QR with column pivoting,
+    dropping the directions below rank_tol relative to the largest one."""
+    Q, R, _ = qr(Z, mode='economic', pivoting=True)
+    d = np.abs(np.diag(R))
+    if len(d) == 0 or d[0] == 0:
+        return Q[:, :0]
+    return Q[:, :np.count_nonzero(d > rank_tol * d[0])]
+
+
+
+def block_cg(operator, B, rtol=1e-8, maxiter=None, X0=None, preconditioner=None, rank_tol=1e-10,
+             return_info=False, callback=None):
+    """Breakdown-free block conjugate gradients (Ji & Li, 2017) for A X = B with a
+    symmetric positive definite operator applied to n x s blocks, operator(P) = A P.
+
+    All right-hand sides share one search space: every iteration applies the
+    operator once to a block of at most m = B.shape[1] directions and the updates
+    are matrix-matrix products. The search directions are re-orthonormalized by
+    rank-revealing QR, so linearly dependent right-hand sides or residuals (e.g.
+    columns that have converged) drop out of the block instead of making the
+    s x s systems singular.
+
+    preconditioner is None, a vector p (Z = p[:,None] * R) or a callable applied
+    to the n x m residual block. Iterates until every column satisfies
+    ||B_j - A X_j|| <= rtol * ||B_j||. Returns X, or (X, info) with a SolverInfo
+    whose residuals are the relative residual norms of all columns per iteration.
+    callback(info) is called after every iteration."""
+    info = SolverInfo('block-cg')
+    tic_total = timer()
+
+    B = np.asarray(B, dtype=float)
+    n, m = B.shape
+    if maxiter is None:
+        maxiter = 10*n
+
+    def apply(P):
+        tic = timer()
+        Q = operator(P)
+        info.time_operator += timer() - tic
+        info.matvecs += P.shape[1]
+        return Q
+
+    def precondition(R):
+        tic = timer()
+        if preconditioner is None:
+            Z = R
+        elif callable(preconditioner):
+            Z = preconditioner(R)
+        else:
+            Z = preconditioner[:,None] * R
+        info.time_precond += timer() - tic
+        return Z
+
+    bnorm = np.linalg.norm(B, axis=0)
+    bnorm[bnorm == 0] = 1
+
+    if X0 is None:
+        X = np.zeros((n, m))
+        R = B.copy()
+    else:
+        X = np.array(X0, dtype=float)
+        R = B - apply(X)
+
+    res = np.linalg.norm(R, axis=0) / bnorm
+    info.residuals.append(res)
+
+    tic = timer()
+    P = _orth(precondition(R), rank_tol)
+    info.time_orth += timer() - tic
+
+    for it in range(maxiter):
+        if np.all(res <= rtol) or P.shape[1] == 0:
+            break
+
+        Q = apply(P)
+
+        tic = timer()
+        PQ = P.T @ Q
+        try:
+            alpha = solve(PQ, P.T @ R, assume_a='pos')
+        except LinAlgError:
+            break
+        X += P @ alpha
+        R -= Q @ alpha
+        res = np.linalg.norm(R, axis=0) / bnorm
+        info.time_orth += timer() - tic
+
+        info.iterations += 1
+        info.residuals.append(res)
+        info.time_total = timer() - tic_total
+        if callback is not None:
+            callback(info)
+        if np.all(res <= rtol):
+            break
+
+        Z = precondition(R)
+
+        tic = timer()
+        beta = -solve(PQ, Q.T @ Z, assume_a='pos')
+        P = _orth(Z + P @ beta, rank_tol)
+        info.time_orth += timer() - tic
+
+    info.converged = bool(np.all(res <= rtol))
+    info.time_total = timer() - tic_total
+
+    if return_info:
+        return X, info
+    return X
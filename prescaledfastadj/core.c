@@ -8,6 +8,9 @@
 #include <string.h>
 #include <complex.h>
 #include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "nfft3.h"
 #include "fastsum.h"
@@ -32,6 +35,14 @@ typedef struct {
     double diagonal;
     int n;
     
+    // cached degree vector and D^{-1/2}, NULL if not computed yet
+    double* degrees;
+    double* d_invsqrt;
+    double* d_inv;
+    
+    // set while a method works on the fastsum plan with the GIL released
+    int busy;
+    
     fastsum_plan* fastsum;
 } AdjacencyCoreObject;
 
@@ -44,9 +55,101 @@ check_fastsum(AdjacencyCoreObject* self)
     return 0;
 }
 
+// The fastsum plan holds the input and output of every transform, so only one
+// thread may use it at a time. Methods that release the GIL mark the core as
+// busy; every method touching the plan checks this flag while holding the GIL.
+static int
+acquire_core(AdjacencyCoreObject* self)
+{
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "AdjacencyCore is in use by another thread");
+        return 0;
+    }
+    self->busy = 1;
+    return 1;
+}
+
+static void
+release_core(AdjacencyCoreObject* self)
+{
+    self->busy = 0;
+}
+
+// Correction of the fastsum result on the diagonal: fastsum includes K(0) for
+// every node, which is 1 for the plain kernels and 0 for the derivative kernels
+static double
+diagonal_correction(AdjacencyCoreObject* self)
+{
+    if (self->kernel == 2 || self->kernel == 4)
+        return self->diagonal;
+    else
+        return self->diagonal - 1.0;
+}
+
+static void
+invalidate_degrees(AdjacencyCoreObject* self)
+{
+    free(self->degrees);
+    free(self->d_invsqrt);
+    free(self->d_inv);
+    self->degrees = NULL;
+    self->d_invsqrt = NULL;
+    self->d_inv = NULL;
+}
+
+// Compute the degree vector A*1, D^{-1/2} and D^{-1} unless they are cached
+// already. Nodes with non-positive degree get zero entries in D^{-1/2} and D^{-1}.
+static int
+compute_degrees(AdjacencyCoreObject* self)
+{
+    int i, n = self->n;
+    double diag;
+    
+    if (self->degrees)
+        return 1;
+    
+    if (!n) {
+        PyErr_SetString(PyExc_RuntimeError, "AdjacencyCore.points must be given before computing degrees");
+        return 0;
+    }
+    
+    if (!acquire_core(self))
+        return 0;
+    
+    self->degrees = (double*) malloc(n*sizeof(double));
+    self->d_invsqrt = (double*) malloc(n*sizeof(double));
+    self->d_inv = (double*) malloc(n*sizeof(double));
+    if (!self->degrees || !self->d_invsqrt || !self->d_inv) {
+        invalidate_degrees(self);
+        release_core(self);
+        PyErr_NoMemory();
+        return 0;
+    }
+    
+    diag = diagonal_correction(self);
+    
+    Py_BEGIN_ALLOW_THREADS
+    for (i=0; i<n; ++i) {
+        self->fastsum->alpha[i] = CMPLX(1.0, 0.0);
+    }
+    fastsum_trafo(self->fastsum);
+    
+    for (i=0; i<n; ++i) {
+        self->degrees[i] = CREAL(self->fastsum->f[i]) + diag;
+        self->d_invsqrt[i] = self->degrees[i] > 0.0 ? 1.0 / sqrt(self->degrees[i]) : 0.0;
+        self->d_inv[i] = self->d_invsqrt[i] * self->d_invsqrt[i];
+    }
+    Py_END_ALLOW_THREADS
+    
+    release_core(self);
+    return 1;
+}
+
 static void
 remove_points(AdjacencyCoreObject* self)
 {
+    invalidate_degrees(self);
+    
     if (self->n) {
        	fastsum_finalize_target_nodes(self->fastsum);
        	fastsum_finalize_source_nodes(self->fastsum);
@@ -133,6 +236,9 @@ AdjacencyCore_init(AdjacencyCoreObject *self, PyObject *args, PyObject *kwds)
     self->fastsum->alpha = NULL;
     self->fastsum->f = NULL;
     self->n = 0;
+    self->degrees = NULL;
+    self->d_invsqrt = NULL;
+    self->d_inv = NULL;
     
     return 0;
 }
@@ -174,6 +280,11 @@ AdjacencyCore_setpoints(AdjacencyCoreObject* self, PyObject* arg, void* closure)
     if (!check_fastsum(self))
         return -1;
     
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "AdjacencyCore is in use by another thread");
+        return -1;
+    }
+    
     remove_points(self);
     
     if (arg == NULL || arg == Py_None)
@@ -222,297 +333,1626 @@ AdjacencyCore_setpoints(AdjacencyCoreObject* self, PyObject* arg, void* closure)
 }
 
 static PyObject *
-AdjacencyCore_apply(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+AdjacencyCore_getsigma(AdjacencyCoreObject* self, void* closure)
 {
-    int i, n, exact=0;
-    PyArrayObject* array;
-    PyObject* item;
-    double* data;
-    static char *kwlist[] = {"points", "exact", NULL};
+    return PyFloat_FromDouble(self->sigma);
+}
 
-    if (!check_fastsum(self))
-        return NULL;
+static int
+AdjacencyCore_setsigma(AdjacencyCoreObject* self, PyObject* arg, void* closure)
+{
+    double sigma;
     
-    n = self->n;
-    if (!n) {
-        PyErr_SetString(PyExc_RuntimeError, "AdjacencyCore.points must be given before calling AdjacencyCore.apply");
-        return NULL;
+    if (arg == NULL) {
+        PyErr_SetString(PyExc_TypeError, "AdjacencyCore.sigma cannot be deleted");
+        return -1;
     }
     
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "O&|p", kwlist, PyArray_Converter, &array, &exact)) {
-        PyErr_Format(PyExc_TypeError, "Invalid input to AdjacencyCore.apply");
-        return NULL;
-    }
+    sigma = PyFloat_AsDouble(arg);
+    if (sigma == -1.0 && PyErr_Occurred())
+        return -1;
     
-    if (PyArray_NDIM(array) != 1 || PyArray_DIM(array, 0) != n) {
-        PyErr_Format(PyExc_ValueError, "First input to AdjacencyCore.apply must be a 1D numpy array with %d entries", n);
-        Py_DECREF(array);
-        return NULL;
+    if (sigma <= 0) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.sigma must be positive");
+        return -1;
     }
     
-    for (i=0; i<n; ++i) {
-        item = PyArray_GETITEM(array, PyArray_GETPTR1(array, i));
-        self->fastsum->alpha[i] = CMPLX(PyFloat_AsDouble(item), 0.0);
-        Py_DECREF(item);
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "AdjacencyCore is in use by another thread");
+        return -1;
     }
     
-    Py_DECREF(array);
-    array = NULL;
-    
-    // PyFloat_AsDouble simply returns -1.0 on errors
-    if (PyErr_Occurred()) {
-        PyErr_SetString(PyExc_TypeError, "AdjacencyCore.apply requires a vector of floating point numbers");
-        return NULL;
+    if (sigma != self->sigma) {
+        // the kernel reads its parameter through a pointer to self->sigma, so only
+        // the kernel coefficients have to be recomputed; the node precomputation stays
+        self->sigma = sigma;
+        if (self->n > 0)
+            fastsum_precompute_kernel(self->fastsum);
+        invalidate_degrees(self);
     }
-    
-    if (exact)
-        fastsum_exact(self->fastsum);
-    else
-        fastsum_trafo(self->fastsum);
+    return 0;
+}
+
+static PyObject *
+AdjacencyCore_getdiagonal(AdjacencyCoreObject* self, void* closure)
+{
+    return PyFloat_FromDouble(self->diagonal);
+}
 
-    array = (PyArrayObject*) PyArray_SimpleNew(1, (npy_intp*) &n, NPY_DOUBLE);
-    PyArray_ENABLEFLAGS(array, NPY_OWNDATA);
+static int
+AdjacencyCore_setdiagonal(AdjacencyCoreObject* self, PyObject* arg, void* closure)
+{
+    double diagonal;
     
-    data = (double*) PyArray_DATA(array);
+    if (arg == NULL) {
+        PyErr_SetString(PyExc_TypeError, "AdjacencyCore.diagonal cannot be deleted");
+        return -1;
+    }
     
-//     for (i=0; i<n; ++i) {
-//         data[i] = CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]);
-//     }
+    diagonal = PyFloat_AsDouble(arg);
+    if (diagonal == -1.0 && PyErr_Occurred())
+        return -1;
     
-    if (self->kernel == 1) { // gaussian kernel
-        for (i=0; i<n; ++i) {
-            data[i] = CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]);
-        }
-    }
-    else if (self->kernel == 2) { // xx_gaussian kernel
-        for (i=0; i<n; ++i) {
-            data[i] = CREAL(self->fastsum->f[i]) + (self->diagonal)*CREAL(self->fastsum->alpha[i]);
-        }
-    }
-    else if (self->kernel == 3) { // laplacian_rbf kernel
-        for (i=0; i<n; ++i) {
-            data[i] = CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]);
-        }
-    }
-    else if (self->kernel == 4) { // der_laplacian_rbf kernel
-        for (i=0; i<n; ++i) {
-            data[i] = CREAL(self->fastsum->f[i]) + (self->diagonal)*CREAL(self->fastsum->alpha[i]);
-        }
-    }
-    else {
-        for (i=0; i<n; ++i) {
-        data[i] = CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]);
-    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "AdjacencyCore is in use by another thread");
+        return -1;
     }
     
-    return (PyObject*) array;
+    if (diagonal != self->diagonal) {
+        self->diagonal = diagonal;
+        invalidate_degrees(self);
+    }
+    return 0;
 }
 
-#ifdef BUILD_EIGS
 static PyObject *
-AdjacencyCore_normalized_eigs(AdjacencyCoreObject* self, PyObject* args, PyObject* keywds) {
-
-    int i, j;
-    npy_intp vec_dims[2];
-    PyObject* result, * eigenvalues, * eigenvectors;
-    double *data;
-    static char *kwlist[] = {"nev", "tol", "maxiter", "ncv", "return_eigenvectors", NULL};
+new_vector_copy(const double* src, int n)
+{
+    npy_intp dims[1] = {n};
+    PyObject* array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    
+    if (array)
+        memcpy(PyArray_DATA((PyArrayObject*)array), src, n*sizeof(double));
+    return array;
+}
 
+static PyObject *
+AdjacencyCore_getdegrees(AdjacencyCoreObject* self, void* closure)
+{
     if (!check_fastsum(self))
         return NULL;
-
-    int n = self->n;    // dimension
-    int nev = 6;        // number of eigenvalues
-    int ncv = 0;        // krylov subspace dimension, default: min(n, max(2*k+1, 20))
-    int maxiter = 0;    // maximum number of iterations
-    double tol = 0.0;   // tolerance
-    int rvecs = 1;      // flag for eigenvector computation
     
-    if (!n) {
-        PyErr_SetString(PyExc_RuntimeError, "AdjacencyCore.points must be given before calling AdjacencyCore.eigs");
-        return NULL;
+    if (!self->n) {
+        Py_RETURN_NONE;
     }
     
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|diip", kwlist, &nev, &tol, &maxiter, &ncv, &rvecs)) {
-        PyErr_Format(PyExc_TypeError, "Invalid input to AdjacencyCore.eigs");
+    if (!compute_degrees(self))
         return NULL;
-    }
     
-    if (ncv <= 0) {
-        if (nev < 10)
-            ncv = 20;
-        else if (2*nev >= n)
-            ncv = n;
-        else
-            ncv = 2*nev + 1;
+    return new_vector_copy(self->degrees, self->n);
+}
+
+static PyObject *
+AdjacencyCore_getd_invsqrt(AdjacencyCoreObject* self, void* closure)
+{
+    if (!check_fastsum(self))
+        return NULL;
+    
+    if (!self->n) {
+        Py_RETURN_NONE;
     }
     
-    if (maxiter <= 0)
-        maxiter = 300; // this is the default from matlab; in scipy, it is n*10
+    if (!compute_degrees(self))
+        return NULL;
+    
+    return new_vector_copy(self->d_invsqrt, self->n);
+}
+
+// Operators available for fused application
+enum {
+    OP_ADJACENCY,       // A
+    OP_NORMALIZED,      // D^{-1/2} A D^{-1/2}
+    OP_LAPLACIAN_SYM,   // I - D^{-1/2} A D^{-1/2}
+    OP_LAPLACIAN_RW,    // I - D^{-1} A
+    OP_LAPLACIAN        // D - A
+};
+
+// Fused operator application
+//     out = sign * M * x + shift * x,
+// where M is one of the operators above. The degree scaling and the shift
+// are folded into the prologue and epilogue of the fastsum transform, so no
+// temporaries are needed. Since the kernel is real, a second vector x2 (if 
+// not NULL) is carried in the imaginary part of the same transform, giving
+// out2 = sign * M * x2 + shift * x2 at no extra cost. Degrees must have been
+// computed for all operators but OP_ADJACENCY. Does not touch any Python objects.
+static void
+fused_apply_pair(AdjacencyCoreObject* self, int op, const double* x, const double* x2, 
+                 double* out, double* out2, double sign, double shift, int exact)
+{
+    int i, n = self->n;
+    double diag = diagonal_correction(self);
+    double a, a2, y, s;
     
+    const double* right = (op == OP_NORMALIZED || op == OP_LAPLACIAN_SYM) ? self->d_invsqrt : NULL;
+    const double* left = (op == OP_LAPLACIAN_RW) ? self->d_inv : right;
+    const double* dvec = (op == OP_LAPLACIAN) ? self->degrees : NULL;
+    
+    // M x = c0 * x + c1 * left * A * right * x  (+ D x for OP_LAPLACIAN)
+    double c0 = (op == OP_LAPLACIAN_SYM || op == OP_LAPLACIAN_RW) ? 1.0 : 0.0;
+    double c1 = (op == OP_ADJACENCY || op == OP_NORMALIZED) ? 1.0 : -1.0;
     
-    // Compute degrees
-    double* d_invsqrt = (double*) malloc(n*sizeof(double));
     for (i=0; i<n; ++i) {
-        self->fastsum->alpha[i] = CMPLX(1.0, 0.0);
+        s = right ? right[i] : 1.0;
+        self->fastsum->alpha[i] = CMPLX(s * x[i], x2 ? s * x2[i] : 0.0);
     }
-    fastsum_trafo(self->fastsum);
     
-//     for (i=0; i<n; ++i) {
-//         d_invsqrt[i] = 1.0 / sqrt(CREAL(self->fastsum->f[i]) + self->diagonal - 1.0);
-//     }
+    if (exact)
+        fastsum_exact(self->fastsum);
+    else
+        fastsum_trafo(self->fastsum);
     
-    if (self->kernel == 1) { // gaussian kernel
-        for (i=0; i<n; ++i) {
-            d_invsqrt[i] = 1.0 / sqrt(CREAL(self->fastsum->f[i]) + self->diagonal - 1.0);
-        }
-    }
-    else if (self->kernel == 2) { // xx_gaussian kernel
-        for (i=0; i<n; ++i) {
-            d_invsqrt[i] = 1.0 / sqrt(CREAL(self->fastsum->f[i]) + self->diagonal);
-        }
-    }
-    else if (self->kernel == 3) { // laplacian_rbf kernel
-        for (i=0; i<n; ++i) {
-            d_invsqrt[i] = 1.0 / sqrt(CREAL(self->fastsum->f[i]) + self->diagonal - 1.0);
-        }
-    }
-    else if (self->kernel == 4) { // der_laplacian_rbf kernel
-        for (i=0; i<n; ++i) {
-            d_invsqrt[i] = 1.0 / sqrt(CREAL(self->fastsum->f[i]) + self->diagonal);
+    for (i=0; i<n; ++i) {
+        s = right ? right[i] : 1.0;
+        a = s * x[i];
+        y = CREAL(self->fastsum->f[i]) + diag * a;
+        if (left)
+            y *= left[i];
+        y = c1 * y + (dvec ? c0 + dvec[i] : c0) * x[i];
+        out[i] = sign * y + shift * x[i];
+        
+        if (x2) {
+            a2 = s * x2[i];
+            y = CIMAG(self->fastsum->f[i]) + diag * a2;
+            if (left)
+                y *= left[i];
+            y = c1 * y + (dvec ? c0 + dvec[i] : c0) * x2[i];
+            out2[i] = sign * y + shift * x2[i];
         }
     }
-    else {
-        for (i=0; i<n; ++i) {
-            d_invsqrt[i] = 1.0 / sqrt(CREAL(self->fastsum->f[i]) + self->diagonal - 1.0);
-        }
+}
+
+static void
+fused_apply(AdjacencyCoreObject* self, int op, const double* x, double* out, 
+            double sign, double shift, int exact)
+{
+    fused_apply_pair(self, op, x, NULL, out, NULL, sign, shift, exact);
+}
+
+// Convert a Python object to a contiguous double vector with n entries.
+// Returns a new reference or NULL with an exception set.
+static PyArrayObject *
+input_vector(PyObject* arg, int n, const char* name)
+{
+    PyArrayObject* array;
+    
+    array = (PyArrayObject*) PyArray_FROM_OTF(arg, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+    if (!array) {
+        PyErr_Format(PyExc_TypeError, "%s requires a vector of floating point numbers", name);
+        return NULL;
     }
-        
-    // Additional inputs for ARPACK
     
-    int ido = 0;    // reverse communication flag.
-    int lworkl = ncv*(ncv+8);   // size of array needed internally
-    int info = 0;   // error flag
+    if (PyArray_NDIM(array) != 1 || PyArray_DIM(array, 0) != n) {
+        PyErr_Format(PyExc_ValueError, "First input to %s must be a 1D numpy array with %d entries", name, n);
+        Py_DECREF(array);
+        return NULL;
+    }
     
-    double* resid = (double*) malloc(n*sizeof(double));
-    double* v = (double*) malloc(n*ncv*sizeof(double));
-    double* workd = (double*) malloc(3*n*sizeof(double));
-    double* workl = (double*) malloc(lworkl*sizeof(double));
-    double* d = (double*) malloc(nev*sizeof(double));
+    return array;
+}
+
+static int
+check_points(AdjacencyCoreObject* self, const char* name)
+{
+    if (!check_fastsum(self))
+        return 0;
     
-    int iparam[11] = {1,0,maxiter,1,0,0,1,0,0,0,0};
-    int ipntr[11] = {0};
-    int *select = (int*) malloc(ncv*sizeof(int));
+    if (!self->n) {
+        PyErr_Format(PyExc_RuntimeError, "AdjacencyCore.points must be given before calling %s", name);
+        return 0;
+    }
+    return 1;
+}
+
+static PyObject *
+apply_operator(AdjacencyCoreObject* self, PyObject* arg, int op, 
+               double sign, double shift, int exact, const char* name)
+{
+    PyArrayObject* array, * result;
+    int n = self->n;
     
-    while (1) {
+    if (op != OP_ADJACENCY && !compute_degrees(self))
+        return NULL;
     
-        dsaupd_c(&ido, "I", n, "LM", nev, tol, resid, ncv, v, n, iparam, ipntr, workd, workl, lworkl, &info);
+    array = input_vector(arg, n, name);
+    if (!array)
+        return NULL;
     
-        if (ido == 1 || ido == -1) {
-            
-            // Compute matrix vector product
-            
-            for (i=0; i<n; ++i) {
-                self->fastsum->alpha[i] = CMPLX(d_invsqrt[i] * workd[ipntr[0] + i], 0);
-            }
-            
-            fastsum_trafo(self->fastsum);
-            
-//             for (i=0; i<n; ++i) {
-//                     workd[ipntr[1] + i] = workd[ipntr[0] + i] + d_invsqrt[i] * 
-//                                     (CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]));
-//                 }
-            
-            if (self->kernel == 1) { // gaussian kernel
-                for (i=0; i<n; ++i) {
-                    workd[ipntr[1] + i] = workd[ipntr[0] + i] + d_invsqrt[i] * 
-                                    (CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]));
-                }
-            }
-            else if (self->kernel == 2) { // xx_gaussian kernel
-                for (i=0; i<n; ++i) {
-                    workd[ipntr[1] + i] = workd[ipntr[0] + i] + d_invsqrt[i] * 
-                                    (CREAL(self->fastsum->f[i]) + (self->diagonal)*CREAL(self->fastsum->alpha[i]));
-                }
-            }
-            else if (self->kernel == 3) { // laplacian_rbf kernel
-                for (i=0; i<n; ++i) {
-                    workd[ipntr[1] + i] = workd[ipntr[0] + i] + d_invsqrt[i] * 
-                                    (CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]));
-                }
-            }
-            else if (self->kernel == 4) { // der_laplacian_rbf kernel
-                for (i=0; i<n; ++i) {
-                    workd[ipntr[1] + i] = workd[ipntr[0] + i] + d_invsqrt[i] * 
-                                    (CREAL(self->fastsum->f[i]) + (self->diagonal)*CREAL(self->fastsum->alpha[i]));
-                }
-            }
-            else {
-                for (i=0; i<n; ++i) {
-                    workd[ipntr[1] + i] = workd[ipntr[0] + i] + d_invsqrt[i] * 
-                                    (CREAL(self->fastsum->f[i]) + (self->diagonal - 1.0)*CREAL(self->fastsum->alpha[i]));
-                }
-            }
+    result = (PyArrayObject*) PyArray_SimpleNew(1, PyArray_DIMS(array), NPY_DOUBLE);
+    if (result) {
+        if (!acquire_core(self)) {
+            Py_DECREF(array);
+            Py_DECREF(result);
+            return NULL;
         }
-        else break;
+        Py_BEGIN_ALLOW_THREADS
+        fused_apply(self, op, (double*) PyArray_DATA(array), (double*) PyArray_DATA(result), 
+                    sign, shift, exact);
+        Py_END_ALLOW_THREADS
+        release_core(self);
     }
     
-    printf("dsaupd terminated after %d iterations, %d mat-vec products, and %d re-orthogonalizations\n", iparam[2], iparam[8], iparam[10]);
+    Py_DECREF(array);
+    return (PyObject*) result;
+}
+
+static PyObject *
+AdjacencyCore_apply(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+{
+    int exact=0;
+    PyObject* arg;
+    static char *kwlist[] = {"points", "exact", NULL};
+
+    if (!check_points(self, "AdjacencyCore.apply"))
+        return NULL;
     
-    if (info < 0) {
-        PyErr_Format(PyExc_RuntimeError, "ARPACK 'dsaupd' failed with error code %d", info);
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "O|p", kwlist, &arg, &exact))
+        return NULL;
+    
+    return apply_operator(self, arg, OP_ADJACENCY, 1.0, 0.0, exact, "AdjacencyCore.apply");
+}
+
+static PyObject *
+AdjacencyCore_apply_normalized(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+{
+    int exact=0;
+    double shift=0.0, sign=1.0;
+    PyObject* arg;
+    static char *kwlist[] = {"v", "shift", "sign", "exact", NULL};
+
+    if (!check_points(self, "AdjacencyCore.apply_normalized"))
+        return NULL;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "O|ddp", kwlist, &arg, &shift, &sign, &exact))
+        return NULL;
+    
+    return apply_operator(self, arg, OP_NORMALIZED, sign, shift, exact, "AdjacencyCore.apply_normalized");
+}
+
+// Map a Laplacian kind ("sym", "rw" or "unnormalized") to an operator
+static int
+laplacian_op(const char* kind)
+{
+    if (strcmp(kind, "sym") == 0)
+        return OP_LAPLACIAN_SYM;
+    if (strcmp(kind, "rw") == 0)
+        return OP_LAPLACIAN_RW;
+    if (strcmp(kind, "unnormalized") == 0)
+        return OP_LAPLACIAN;
+    
+    PyErr_Format(PyExc_ValueError, "Unknown Laplacian kind '%s' (expected 'sym', 'rw' or 'unnormalized')", kind);
+    return -1;
+}
+
+static PyObject *
+AdjacencyCore_apply_laplacian(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+{
+    int op, exact=0;
+    double shift=0.0, sign=1.0;
+    const char* kind = "sym";
+    PyObject* arg;
+    static char *kwlist[] = {"v", "kind", "shift", "sign", "exact", NULL};
+
+    if (!check_points(self, "AdjacencyCore.apply_laplacian"))
+        return NULL;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "O|sddp", kwlist, &arg, &kind, &shift, &sign, &exact))
+        return NULL;
+    
+    op = laplacian_op(kind);
+    if (op < 0)
+        return NULL;
+    
+    return apply_operator(self, arg, op, sign, shift, exact, "AdjacencyCore.apply_laplacian");
+}
+
+// Map an operator name ("adjacency", "normalized" or a Laplacian kind) to an operator
+static int
+operator_op(const char* name)
+{
+    if (strcmp(name, "adjacency") == 0)
+        return OP_ADJACENCY;
+    if (strcmp(name, "normalized") == 0)
+        return OP_NORMALIZED;
+    if (strcmp(name, "sym") == 0 || strcmp(name, "rw") == 0 || strcmp(name, "unnormalized") == 0)
+        return laplacian_op(name);
+    
+    PyErr_Format(PyExc_ValueError, "Unknown operator '%s' (expected 'adjacency', 'normalized', 'sym', 'rw' or 'unnormalized')", name);
+    return -1;
+}
+
+// Apply sign * M + shift * I to the columns of an n x m array, two columns
+// per fastsum transform. Returns a new Fortran-ordered n x m array.
+static PyObject *
+AdjacencyCore_apply_block(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+{
+    int j, m, op, n, exact = 0;
+    double shift = 0.0, sign = 1.0;
+    double* x, * y;
+    const char* name = "adjacency";
+    PyObject* arg;
+    PyArrayObject* array, * result;
+    static char *kwlist[] = {"X", "op", "shift", "sign", "exact", NULL};
+    
+    if (!check_points(self, "AdjacencyCore.apply_block"))
+        return NULL;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "O|sddp", kwlist, &arg, &name, &shift, &sign, &exact))
+        return NULL;
+    
+    op = operator_op(name);
+    if (op < 0)
+        return NULL;
+    if (op != OP_ADJACENCY && !compute_degrees(self))
+        return NULL;
+    
+    n = self->n;
+    array = (PyArrayObject*) PyArray_FROM_OTF(arg, NPY_DOUBLE, NPY_ARRAY_FARRAY_RO);
+    if (!array) {
+        PyErr_SetString(PyExc_TypeError, "AdjacencyCore.apply_block requires an array of floating point numbers");
+        return NULL;
+    }
+    if (PyArray_NDIM(array) != 2 || PyArray_DIM(array, 0) != n) {
+        PyErr_Format(PyExc_ValueError, "First input to AdjacencyCore.apply_block must be a 2D numpy array with %d rows", n);
+        Py_DECREF(array);
+        return NULL;
+    }
+    m = PyArray_DIM(array, 1);
+    
+    result = (PyArrayObject*) PyArray_EMPTY(2, PyArray_DIMS(array), NPY_DOUBLE, 1);
+    if (!result) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    
+    if (!acquire_core(self)) {
+        Py_DECREF(array);
+        Py_DECREF(result);
+        return NULL;
+    }
+    
+    x = (double*) PyArray_DATA(array);
+    y = (double*) PyArray_DATA(result);
+    
+    Py_BEGIN_ALLOW_THREADS
+    for (j=0; j+1<m; j+=2)
+        fused_apply_pair(self, op, x + j*n, x + (j+1)*n, y + j*n, y + (j+1)*n, sign, shift, exact);
+    if (m % 2)
+        fused_apply(self, op, x + (m-1)*n, y + (m-1)*n, sign, shift, exact);
+    Py_END_ALLOW_THREADS
+    release_core(self);
+    
+    Py_DECREF(array);
+    return (PyObject*) result;
+}
+
+// Exact block out = A[rows, cols] (Fortran order, nrows x ncols) of the adjacency
+// matrix, evaluated with the kernel function of the fastsum plan on the prescaled 
+// nodes, so that it agrees with fastsum_exact. rows == NULL selects all rows.
+// The block is split into row chunks of every column, which are distributed
+// over OpenMP threads; within a chunk the squared distances are computed in a
+// vectorized loop before the kernel is evaluated. Does not touch any Python objects.
+#define KERNEL_CHUNK 256
+static void
+kernel_block(AdjacencyCoreObject* self, const npy_intp* rows, npy_intp nrows, 
+             const npy_intp* cols, npy_intp ncols, double* out)
+{
+    int d = self->d;
+    const double* x = self->fastsum->x;
+    npy_intp nchunks = (nrows + KERNEL_CHUNK - 1) / KERNEL_CHUNK;
+    npy_intp task;
+    
+    #pragma omp parallel for schedule(dynamic)
+    for (task=0; task<ncols*nchunks; ++task) {
+        npy_intp a, b = task / nchunks, j = cols[b];
+        npy_intp start = (task % nchunks) * KERNEL_CHUNK;
+        npy_intp end = start + KERNEL_CHUNK < nrows ? start + KERNEL_CHUNK : nrows;
+        double* col = out + b*nrows;
+        int l;
+        
+        for (a=start; a<end; ++a)
+            col[a] = 0.0;
+        for (l=0; l<d; ++l) {
+            double xj = x[j*d + l];
+            #pragma omp simd
+            for (a=start; a<end; ++a) {
+                double t = x[(rows ? rows[a] : a)*d + l] - xj;
+                col[a] += t * t;
+            }
+        }
+        for (a=start; a<end; ++a) {
+            if ((rows ? rows[a] : a) == j)
+                col[a] = self->diagonal;
+            else
+                col[a] = CREAL(self->fastsum->k(sqrt(col[a]), 0, self->fastsum->kernel_param));
+        }
+    }
+}
+
+// Convert a Python sequence of point indices to a contiguous index array.
+// Returns a new reference or NULL with an exception set.
+static PyArrayObject *
+input_indices(PyObject* arg, int n, const char* name)
+{
+    npy_intp j, *idx;
+    PyArrayObject* indices;
+    
+    indices = (PyArrayObject*) PyArray_FROM_OTF(arg, NPY_INTP, NPY_ARRAY_IN_ARRAY);
+    if (!indices || PyArray_NDIM(indices) != 1) {
+        Py_XDECREF(indices);
+        PyErr_Format(PyExc_TypeError, "%s requires 1D sequences of indices", name);
+        return NULL;
+    }
+    
+    idx = (npy_intp*) PyArray_DATA(indices);
+    for (j=0; j<PyArray_DIM(indices, 0); ++j) {
+        if (idx[j] < 0 || idx[j] >= n) {
+            PyErr_Format(PyExc_IndexError, "%s: index %ld out of range for %d points", name, (long) idx[j], n);
+            Py_DECREF(indices);
+            return NULL;
+        }
+    }
+    return indices;
+}
+
+// Exact submatrix A[I, J]; with J omitted, A[I, I]. I may be None for all rows.
+// Returns a new Fortran-ordered array.
+static PyObject *
+AdjacencyCore_submatrix(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+{
+    npy_intp dims[2];
+    PyObject* argI, * argJ = Py_None;
+    PyArrayObject* rows = NULL, * cols = NULL, * result;
+    static char *kwlist[] = {"I", "J", NULL};
+    
+    if (!check_points(self, "AdjacencyCore.submatrix"))
+        return NULL;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "O|O", kwlist, &argI, &argJ))
+        return NULL;
+    
+    if (argI != Py_None) {
+        rows = input_indices(argI, self->n, "AdjacencyCore.submatrix");
+        if (!rows)
+            return NULL;
+    }
+    if (argJ == Py_None && rows) {
+        cols = rows;
+        Py_INCREF(cols);
+    }
+    else {
+        cols = input_indices(argJ == Py_None ? argI : argJ, self->n, "AdjacencyCore.submatrix");
+        if (!cols) {
+            Py_XDECREF(rows);
+            return NULL;
+        }
+    }
+    
+    dims[0] = rows ? PyArray_DIM(rows, 0) : self->n;
+    dims[1] = PyArray_DIM(cols, 0);
+    result = (PyArrayObject*) PyArray_EMPTY(2, dims, NPY_DOUBLE, 1);
+    if (result && !acquire_core(self))
+        Py_CLEAR(result);
+    if (result) {
+        Py_BEGIN_ALLOW_THREADS
+        kernel_block(self, rows ? (npy_intp*) PyArray_DATA(rows) : NULL, dims[0], 
+                     (npy_intp*) PyArray_DATA(cols), dims[1], (double*) PyArray_DATA(result));
+        Py_END_ALLOW_THREADS
+        release_core(self);
+    }
+    
+    Py_XDECREF(rows);
+    Py_DECREF(cols);
+    return (PyObject*) result;
+}
+
+// Exact columns A[:, J]
+static PyObject *
+AdjacencyCore_columns(AdjacencyCoreObject* self, PyObject* args)
+{
+    PyObject* arg, * result;
+    
+    if (!PyArg_ParseTuple(args, "O", &arg))
+        return NULL;
+    
+    args = Py_BuildValue("(OO)", Py_None, arg);
+    if (!args)
+        return NULL;
+    result = AdjacencyCore_submatrix(self, args, NULL);
+    Py_DECREF(args);
+    return result;
+}
+
+// Diagonal of the adjacency matrix
+static PyObject *
+AdjacencyCore_diag(AdjacencyCoreObject* self, PyObject* Py_UNUSED(ignored))
+{
+    int i;
+    npy_intp dims[1];
+    PyObject* result;
+    
+    if (!check_points(self, "AdjacencyCore.diag"))
+        return NULL;
+    
+    dims[0] = self->n;
+    result = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    if (result) {
+        for (i=0; i<self->n; ++i)
+            ((double*) PyArray_DATA((PyArrayObject*) result))[i] = self->diagonal;
+    }
+    return result;
+}
+
+typedef struct {
+    int64_t key;
+    npy_intp index;
+} CellEntry;
+
+static int
+compare_cell_entries(const void* a, const void* b)
+{
+    int64_t ka = ((const CellEntry*) a)->key, kb = ((const CellEntry*) b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+// Greedy coloring of the graph that connects all nodes closer than radius, such
+// that nodes of equal color are at least radius apart. The nodes are binned into
+// grid cells of width radius and sorted by cell, so the neighbors of a node are
+// found in the 3^d adjacent cells by binary search. Returns the color of every
+// node; the number of colors is bounded by the maximum number of neighbors + 1.
+static PyObject *
+AdjacencyCore_distance_coloring(AdjacencyCoreObject* self, PyObject* args)
+{
+    int l, d, ok = 1, acquired = 0;
+    npy_intp i, j, p, n, lo_idx, hi_idx, mid, t, num_offsets, dims[1];
+    npy_intp* colors, * mark = NULL;
+    int64_t key, stride, offset, total = 1;
+    int64_t* cells = NULL, * counts = NULL;
+    double radius, dist, diff, * lo = NULL;
+    const double* x;
+    CellEntry* entries = NULL;
+    PyArrayObject* result;
+    
+    if (!check_points(self, "AdjacencyCore.distance_coloring"))
+        return NULL;
+    
+    if (!PyArg_ParseTuple(args, "d", &radius))
+        return NULL;
+    if (!(radius > 0.0)) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.distance_coloring requires a positive radius");
+        return NULL;
+    }
+    
+    n = self->n;
+    d = self->d;
+    x = self->fastsum->x;
+    
+    lo = (double*) malloc(d*sizeof(double));
+    counts = (int64_t*) malloc(d*sizeof(int64_t));
+    cells = (int64_t*) malloc(n*d*sizeof(int64_t));
+    entries = (CellEntry*) malloc(n*sizeof(CellEntry));
+    mark = (npy_intp*) malloc((n+1)*sizeof(npy_intp));
+    if (!lo || !counts || !cells || !entries || !mark) {
+        PyErr_NoMemory();
         result = NULL;
+        goto cleanup;
+    }
+    // the nodes must not change while they are read without the GIL
+    if (!acquire_core(self)) {
+        result = NULL;
+        goto cleanup;
+    }
+    acquired = 1;
+    
+    // grid of cells with width radius over the bounding box
+    for (l=0; l<d; ++l) {
+        double hi = x[l];
+        lo[l] = x[l];
+        for (i=1; i<n; ++i) {
+            lo[l] = fmin(lo[l], x[i*d + l]);
+            hi = fmax(hi, x[i*d + l]);
+        }
+        counts[l] = (int64_t) ((hi - lo[l]) / radius) + 1;
+        if (counts[l] > INT64_MAX / 4 / total) {
+            PyErr_SetString(PyExc_ValueError, "AdjacencyCore.distance_coloring: radius too small for the grid");
+            result = NULL;
+            goto cleanup;
+        }
+        total *= counts[l];
+    }
+    
+    dims[0] = n;
+    result = (PyArrayObject*) PyArray_EMPTY(1, dims, NPY_INTP, 0);
+    if (!result)
+        goto cleanup;
+    colors = (npy_intp*) PyArray_DATA(result);
+    
+    Py_BEGIN_ALLOW_THREADS
+    
+    for (i=0; i<n; ++i) {
+        key = 0;
+        for (l=d-1; l>=0; --l) {
+            cells[i*d + l] = (int64_t) ((x[i*d + l] - lo[l]) / radius);
+            if (cells[i*d + l] >= counts[l])
+                cells[i*d + l] = counts[l] - 1;
+            key = key * counts[l] + cells[i*d + l];
+        }
+        entries[i].key = key;
+        entries[i].index = i;
+        colors[i] = -1;
+        mark[i] = -1;
+    }
+    mark[n] = -1;
+    qsort(entries, n, sizeof(CellEntry), compare_cell_entries);
+    
+    num_offsets = 1;
+    for (l=0; l<d; ++l)
+        num_offsets *= 3;
+    
+    // color the nodes in cell order, marking the colors of the colored neighbors
+    for (p=0; p<n; ++p) {
+        i = entries[p].index;
+        
+        for (t=0; t<num_offsets; ++t) {
+            key = 0;
+            offset = t;
+            ok = 1;
+            for (l=d-1; l>=0; --l) {
+                stride = 1;
+                for (j=0; j<l; ++j)
+                    stride *= 3;
+                int64_t c = cells[i*d + l] + (offset / stride) - 1;
+                offset %= stride;
+                if (c < 0 || c >= counts[l]) {
+                    ok = 0;
+                    break;
+                }
+                key = key * counts[l] + c;
+            }
+            if (!ok)
+                continue;
+            
+            // first entry with this key
+            lo_idx = 0;
+            hi_idx = n;
+            while (lo_idx < hi_idx) {
+                mid = (lo_idx + hi_idx) / 2;
+                if (entries[mid].key < key)
+                    lo_idx = mid + 1;
+                else
+                    hi_idx = mid;
+            }
+            
+            for (; lo_idx<n && entries[lo_idx].key == key; ++lo_idx) {
+                j = entries[lo_idx].index;
+                if (j == i || colors[j] < 0)
+                    continue;
+                dist = 0.0;
+                for (l=0; l<d; ++l) {
+                    diff = x[i*d + l] - x[j*d + l];
+                    dist += diff * diff;
+                }
+                if (dist < radius * radius)
+                    mark[colors[j]] = i;
+            }
+        }
+        
+        for (j=0; mark[j] == i; ++j)
+            ;
+        colors[i] = j;
+    }
+    
+    Py_END_ALLOW_THREADS
+    
+cleanup:
+    if (acquired)
+        release_core(self);
+    free(lo);
+    free(counts);
+    free(cells);
+    free(entries);
+    free(mark);
+    
+    return (PyObject*) result;
+}
+
+// Uniformly distributed random number in [-1, 1) (splitmix64)
+static double
+random_uniform(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+// Monotonic wall time in seconds
+static double
+wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static double
+dot(const double* x, const double* y, int n)
+{
+    int i;
+    double s = 0.0;
+    for (i=0; i<n; ++i)
+        s += x[i] * y[i];
+    return s;
+}
+
+// Number of eigenvalues smaller than x of the symmetric tridiagonal matrix
+// with diagonal a[0..k-1] and off-diagonal b[0..k-2] (Sturm sequence)
+static int
+tridiag_count(const double* a, const double* b, int k, double x)
+{
+    int i, count = 0;
+    double q = a[0] - x;
+    
+    for (i=0; ; ++i) {
+        if (q < 0.0)
+            count++;
+        if (i == k-1)
+            break;
+        if (q == 0.0)
+            q = DBL_EPSILON * (fabs(b[i]) + DBL_MIN);
+        q = a[i+1] - x - b[i]*b[i] / q;
+    }
+    return count;
+}
+
+// j-th smallest eigenvalue (j = 0, ..., k-1) of a symmetric tridiagonal
+// matrix, computed by bisection on its Gershgorin interval
+static double
+tridiag_eigenvalue(const double* a, const double* b, int k, int j)
+{
+    int i;
+    double r, lo = a[0], hi = a[0], mid;
+    
+    for (i=0; i<k; ++i) {
+        r = (i > 0 ? fabs(b[i-1]) : 0.0) + (i < k-1 ? fabs(b[i]) : 0.0);
+        lo = fmin(lo, a[i] - r);
+        hi = fmax(hi, a[i] + r);
+    }
+    
+    while (1) {
+        mid = 0.5 * (lo + hi);
+        if (mid <= lo || mid >= hi)
+            break;
+        if (tridiag_count(a, b, k, mid) > j)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return mid;
+}
+
+// Modulus of the last entry of the normalized eigenvector of the symmetric
+// tridiagonal matrix for the eigenvalue theta, via the three-term recurrence.
+// All off-diagonal entries must be nonzero.
+static double
+tridiag_last_component(const double* a, const double* b, int k, double theta)
+{
+    int i;
+    double z0 = 0.0, z1 = 1.0, z2, nrm2 = 1.0;
+    
+    for (i=0; i<k-1; ++i) {
+        z2 = ((theta - a[i]) * z1 - (i > 0 ? b[i-1] * z0 : 0.0)) / b[i];
+        z0 = z1;
+        z1 = z2;
+        nrm2 += z2 * z2;
+        if (nrm2 > 1e200) {
+            z0 *= 1e-100;
+            z1 *= 1e-100;
+            nrm2 *= 1e-200;
+        }
+    }
+    return fabs(z1) / sqrt(nrm2);
+}
+
+// Lanczos estimation of the spectral norm of a symmetric operator. After k
+// steps the extreme Ritz values theta_min <= theta_max of the tridiagonal
+// matrix T_k lie inside the spectrum, which gives the deterministic lower bound
+// max(|theta_min|, |theta_max|). Residual norms of Ritz pairs only bound the
+// distance to some eigenvalue, not to the extreme ones, so the upper bound is
+// probabilistic: for a start vector uniformly distributed on the sphere,
+// Kuczynski & Wozniakowski (1992) show that each extreme Ritz value is farther
+// than eps * (lambda_max - lambda_min) from the extreme eigenvalue with
+// probability at most 1.648 sqrt(n) exp(-sqrt(eps) (2k-1)). Choosing eps such
+// that both ends together fail with probability at most delta, the spread is at
+// most S = (theta_max - theta_min) / (1 - 2 eps), and
+//     upper = max(|theta_max + eps S|, |theta_min - eps S|)
+// bounds the norm with probability at least 1 - delta (infinite while
+// eps >= 1/2). The estimate refines the largest Ritz value by the Kato-Temple
+// correction r^2 / gap if gap > r, clipped to [lower, upper]. Iterates until
+// upper - lower <= rtol * upper.
+static PyObject *
+AdjacencyCore_lanczos_norm(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+{
+    int i, j, op, n, maxiter = 100, matvecs = 0;
+    double rtol = 1e-3, delta = 1e-3, nrm, theta_min, theta_max, theta_next, r, eps, spread;
+    double estimate = 0.0, lower = 0.0, upper = INFINITY;
+    double *q, *q_prev, *w, *tmp, *alpha, *beta;
+    unsigned long long seed = 0;
+    uint64_t state;
+    const char* name = "sym";
+    static char *kwlist[] = {"op", "rtol", "maxiter", "seed", "delta", NULL};
+    
+    if (!check_points(self, "AdjacencyCore.lanczos_norm"))
+        return NULL;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "|sdiKd", kwlist, &name, &rtol, &maxiter, &seed, &delta))
+        return NULL;
+    
+    op = operator_op(name);
+    if (op < 0)
+        return NULL;
+    if (op == OP_LAPLACIAN_RW) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.lanczos_norm requires a symmetric operator");
+        return NULL;
+    }
+    if (!(delta > 0.0 && delta < 1.0)) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.lanczos_norm requires 0 < delta < 1");
+        return NULL;
+    }
+    if (maxiter <= 0) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.lanczos_norm requires maxiter > 0");
+        return NULL;
+    }
+    
+    if (op != OP_ADJACENCY && !compute_degrees(self))
+        return NULL;
+    
+    n = self->n;
+    q = (double*) malloc(n*sizeof(double));
+    q_prev = (double*) calloc(n, sizeof(double));
+    w = (double*) malloc(n*sizeof(double));
+    alpha = (double*) malloc(maxiter*sizeof(double));
+    beta = (double*) malloc(maxiter*sizeof(double));
+    
+    if (!q || !q_prev || !w || !alpha || !beta) {
+        free(q); free(q_prev); free(w); free(alpha); free(beta);
+        return PyErr_NoMemory();
+    }
+    
+    if (!acquire_core(self)) {
+        free(q); free(q_prev); free(w); free(alpha); free(beta);
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    
+    // Gaussian start vector (Box-Muller), uniformly distributed on the sphere after normalization
+    state = seed;
+    for (i=0; i<n; ++i) {
+        double u = 1.0 - (random_uniform(&state) + 1.0) / 2.0;
+        q[i] = sqrt(-2.0 * log(u)) * cos(M_PI * random_uniform(&state));
+    }
+    nrm = sqrt(dot(q, q, n));
+    for (i=0; i<n; ++i)
+        q[i] /= nrm;
+    
+    for (j=0; j<maxiter; ++j) {
+        fused_apply(self, op, q, w, 1.0, 0.0, 0);
+        matvecs++;
+        
+        alpha[j] = dot(q, w, n);
+        for (i=0; i<n; ++i)
+            w[i] -= alpha[j] * q[i] + (j > 0 ? beta[j-1] * q_prev[i] : 0.0);
+        beta[j] = sqrt(dot(w, w, n));
+        
+        theta_min = tridiag_eigenvalue(alpha, beta, j+1, 0);
+        theta_max = tridiag_eigenvalue(alpha, beta, j+1, j);
+        lower = fmax(fabs(theta_min), fabs(theta_max));
+        
+        // invariant subspace found, the Ritz values are eigenvalues
+        if (beta[j] <= DBL_EPSILON * lower || beta[j] == 0.0) {
+            estimate = upper = lower;
+            break;
+        }
+        
+        eps = log(2.0 * 1.648 * sqrt((double) n) / delta) / (2.0*(j+1) - 1.0);
+        eps *= eps;
+        if (eps < 0.5) {
+            spread = (theta_max - theta_min) / (1.0 - 2.0*eps);
+            upper = fmax(fabs(theta_max + eps*spread), fabs(theta_min - eps*spread));
+        }
+        
+        estimate = lower;
+        if (j > 0) {
+            double theta = fabs(theta_max) >= fabs(theta_min) ? theta_max : theta_min;
+            theta_next = tridiag_eigenvalue(alpha, beta, j+1, theta == theta_max ? j-1 : 1);
+            r = beta[j] * tridiag_last_component(alpha, beta, j+1, theta);
+            // only meaningful if the next Ritz value is separated by more than the residual
+            if (fabs(theta - theta_next) > r)
+                estimate = fmin(lower + r*r / fabs(theta - theta_next), upper);
+        }
+        
+        if (isfinite(upper) && upper - lower <= rtol * upper)
+            break;
+        
+        tmp = q_prev;
+        q_prev = q;
+        q = tmp;
+        for (i=0; i<n; ++i)
+            q[i] = w[i] / beta[j];
+    }
+    
+    Py_END_ALLOW_THREADS
+    release_core(self);
+    
+    free(q); free(q_prev); free(w); free(alpha); free(beta);
+    
+    return Py_BuildValue("dddi", estimate, lower, upper, matvecs);
+}
+
+// Preconditioner hook for the Krylov solvers: z = P r with P either the
+// identity, a diagonal scaling vector or a Python callable. The solvers run
+// with the GIL released; a callable temporarily reacquires it through the
+// saved thread state, so it must not use the same AdjacencyCore.
+typedef struct {
+    int n;
+    const double* diag;         // elementwise scaling, or NULL
+    PyObject* func;             // callable r -> z, or NULL
+    PyArrayObject* r;           // input vector passed to func
+    PyThreadState* save;        // thread state while the GIL is released
+    double time;                // wall time spent in the preconditioner
+} Preconditioner;
+
+// Returns 0 on success and -1 with a Python exception set if the callable failed
+static int
+apply_preconditioner(Preconditioner* P, const double* r, double* z)
+{
+    int i, n = P->n, status = 0;
+    double tic = wall_time();
+    PyObject* result;
+    PyArrayObject* array;
+    
+    if (P->func) {
+        PyEval_RestoreThread(P->save);
+        memcpy(PyArray_DATA(P->r), r, n*sizeof(double));
+        result = PyObject_CallFunctionObjArgs(P->func, (PyObject*) P->r, NULL);
+        array = result ? input_vector(result, n, "the preconditioner") : NULL;
+        if (array) {
+            memcpy(z, PyArray_DATA(array), n*sizeof(double));
+            Py_DECREF(array);
+        }
+        else
+            status = -1;
+        Py_XDECREF(result);
+        P->save = PyEval_SaveThread();
+    }
+    else if (P->diag) {
+        for (i=0; i<n; ++i)
+            z[i] = P->diag[i] * r[i];
+    }
+    else
+        memcpy(z, r, n*sizeof(double));
+    
+    P->time += wall_time() - tic;
+    return status;
+}
+
+// Default maximum number of iterations of AdjacencyCore.solve for n > 1000
+#define SOLVE_MAXITER_DEFAULT 10000
+
+// Result codes of the Krylov solvers
+enum {
+    SOLVE_CONVERGED,
+    SOLVE_MAXITER,      // maxiter reached
+    SOLVE_BREAKDOWN,    // operator (CG) or preconditioner not positive definite
+    SOLVE_ERROR         // the preconditioner raised an exception
+};
+
+typedef struct {
+    int iterations;
+    int matvecs;
+    double time_operator;
+    double* residuals;  // relative residual norm after every iteration
+    int capacity;       // allocated entries of residuals, grown geometrically
+} SolveStats;
+
+// Appends a relative residual norm, doubling the storage when it is full, so 
+// that it grows with the iterations actually done rather than with maxiter.
+// Returns -1 if out of memory.
+static int
+record_residual(SolveStats* stats, double res)
+{
+    int count = stats->iterations + 1;
+    double* residuals;
+    
+    if (count >= stats->capacity) {
+        residuals = (double*) realloc(stats->residuals, 2*stats->capacity*sizeof(double));
+        if (!residuals)
+            return -1;
+        stats->residuals = residuals;
+        stats->capacity *= 2;
+    }
+    stats->residuals[count] = res;
+    return 0;
+}
+
+static void
+solver_apply(AdjacencyCoreObject* self, int op, const double* x, double* y, 
+             double sign, double shift, int exact, SolveStats* stats)
+{
+    double tic = wall_time();
+    fused_apply(self, op, x, y, sign, shift, exact);
+    stats->time_operator += wall_time() - tic;
+    stats->matvecs++;
+}
+
+// Preconditioned conjugate gradients for (sign * M + shift * I) x = b, which
+// must be positive definite. x holds the initial guess on input. Stops when
+// ||b - (sign * M + shift * I) x|| <= rtol * ||b||.
+static int
+solve_cg(AdjacencyCoreObject* self, int op, double sign, double shift, int exact,
+         const double* b, double* x, double rtol, int maxiter, 
+         Preconditioner* P, SolveStats* stats)
+{
+    int i, it, n = self->n, status = SOLVE_MAXITER;
+    double alpha, beta, pq, rz = 0.0, rz_new, res, bnorm;
+    double* r = (double*) malloc(n*sizeof(double));
+    double* z = (double*) malloc(n*sizeof(double));
+    double* p = (double*) malloc(n*sizeof(double));
+    double* q = (double*) malloc(n*sizeof(double));
+    
+    if (!r || !z || !p || !q) {
+        free(r); free(z); free(p); free(q);
+        return -1;
     }
+    
+    bnorm = sqrt(dot(b, b, n));
+    if (bnorm == 0.0)
+        bnorm = 1.0;
+    
+    solver_apply(self, op, x, q, sign, shift, exact, stats);
+    for (i=0; i<n; ++i)
+        r[i] = b[i] - q[i];
+    res = sqrt(dot(r, r, n)) / bnorm;
+    stats->residuals[0] = res;
+    
+    if (res <= rtol)
+        status = SOLVE_CONVERGED;
+    else if (apply_preconditioner(P, r, z) < 0)
+        status = SOLVE_ERROR;
     else {
+        memcpy(p, z, n*sizeof(double));
+        rz = dot(r, z, n);
+    }
     
-        dseupd_c(rvecs, "A", select, d, v, n, 0.0, "I", n, "LM", nev, tol, resid, ncv, v, n, iparam, ipntr, workd, workl, lworkl, &info);
+    for (it=0; it<maxiter && status == SOLVE_MAXITER; ++it) {
+        if (rz <= 0.0) {
+            status = SOLVE_BREAKDOWN;
+            break;
+        }
         
-        if (info < 0) {
-            PyErr_Format(PyExc_RuntimeError, "ARPACK 'dseupd' failed with error code %d", info);
-            result = NULL;
+        solver_apply(self, op, p, q, sign, shift, exact, stats);
+        pq = dot(p, q, n);
+        if (pq <= 0.0) {
+            status = SOLVE_BREAKDOWN;
+            break;
+        }
+        
+        alpha = rz / pq;
+        for (i=0; i<n; ++i) {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+        res = sqrt(dot(r, r, n)) / bnorm;
+        if (record_residual(stats, res) < 0) {
+            status = -1;
+            break;
+        }
+        stats->iterations++;
+        if (res <= rtol) {
+            status = SOLVE_CONVERGED;
+            break;
+        }
+        
+        if (apply_preconditioner(P, r, z) < 0) {
+            status = SOLVE_ERROR;
+            break;
         }
-        else {
-            // Build eigenvalue object
-            vec_dims[0] = nev;
-            eigenvalues = PyArray_SimpleNew(1, vec_dims, NPY_DOUBLE);
-            PyArray_ENABLEFLAGS((PyArrayObject*) eigenvalues, NPY_OWNDATA);
+        rz_new = dot(r, z, n);
+        beta = rz_new / rz;
+        rz = rz_new;
+        for (i=0; i<n; ++i)
+            p[i] = z[i] + beta * p[i];
+    }
     
-            data = (double*) PyArray_DATA((PyArrayObject*) eigenvalues);
-            for (j=0; j<nev; ++j) {
-                data[j] = d[j] - 1.0;
-            }
+    free(r); free(z); free(p); free(q);
+    return status;
+}
+
+// Preconditioned MINRES (Paige & Saunders, 1975) for the symmetric, possibly
+// indefinite system (sign * M + shift * I) x = b, e.g. for the derivative 
+// kernels. The preconditioner must be positive definite. x holds the initial
+// guess on input. The residual is monitored in the norm induced by the 
+// preconditioner, relative to that of the initial residual.
+static int
+solve_minres(AdjacencyCoreObject* self, int op, double sign, double shift, int exact,
+             const double* b, double* x, double rtol, int maxiter, 
+             Preconditioner* P, SolveStats* stats)
+{
+    int i, it, n = self->n, status = SOLVE_MAXITER;
+    double alpha, beta, beta1, oldb, oldeps, epsln = 0.0, delta, gbar, dbar = 0.0;
+    double gamma, cs = -1.0, sn = 0.0, phi, phibar, s;
+    double* r1 = (double*) malloc(n*sizeof(double));
+    double* r2 = (double*) malloc(n*sizeof(double));
+    double* y = (double*) malloc(n*sizeof(double));
+    double* v = (double*) malloc(n*sizeof(double));
+    double* w = (double*) calloc(n, sizeof(double));
+    double* w1 = (double*) calloc(n, sizeof(double));
+    double* w2 = (double*) calloc(n, sizeof(double));
+    double* tmp;
+    
+    if (!r1 || !r2 || !y || !v || !w || !w1 || !w2) {
+        free(r1); free(r2); free(y); free(v); free(w); free(w1); free(w2);
+        return -1;
+    }
+    
+    solver_apply(self, op, x, y, sign, shift, exact, stats);
+    for (i=0; i<n; ++i)
+        r1[i] = b[i] - y[i];
+    if (apply_preconditioner(P, r1, y) < 0) {
+        status = SOLVE_ERROR;
+        beta1 = 0.0;
+    }
+    else {
+        beta1 = dot(r1, y, n);
+        stats->residuals[0] = beta1 > 0.0 ? 1.0 : 0.0;
+        if (beta1 < 0.0)
+            status = SOLVE_BREAKDOWN;
+        else if (beta1 == 0.0)
+            status = SOLVE_CONVERGED;
+        beta1 = sqrt(fabs(beta1));
+    }
+    memcpy(r2, r1, n*sizeof(double));
+    beta = beta1;
+    oldb = 0.0;
+    phibar = beta1;
+    
+    for (it=0; it<maxiter && status == SOLVE_MAXITER; ++it) {
+        s = 1.0 / beta;
+        for (i=0; i<n; ++i)
+            v[i] = s * y[i];
+        
+        solver_apply(self, op, v, y, sign, shift, exact, stats);
+        if (it > 0) {
+            for (i=0; i<n; ++i)
+                y[i] -= (beta / oldb) * r1[i];
+        }
+        alpha = dot(v, y, n);
+        for (i=0; i<n; ++i)
+            y[i] -= (alpha / beta) * r2[i];
+        
+        tmp = r1;
+        r1 = r2;
+        r2 = y;
+        y = tmp;
+        if (apply_preconditioner(P, r2, y) < 0) {
+            status = SOLVE_ERROR;
+            break;
+        }
+        oldb = beta;
+        beta = dot(r2, y, n);
+        if (beta < 0.0) {
+            status = SOLVE_BREAKDOWN;
+            break;
+        }
+        beta = sqrt(beta);
+        
+        // apply the previous rotation and compute the next one
+        oldeps = epsln;
+        delta = cs * dbar + sn * alpha;
+        gbar = sn * dbar - cs * alpha;
+        epsln = sn * beta;
+        dbar = -cs * beta;
+        gamma = fmax(hypot(gbar, beta), DBL_EPSILON);
+        cs = gbar / gamma;
+        sn = beta / gamma;
+        phi = cs * phibar;
+        phibar = sn * phibar;
+        
+        // update the search direction and the solution
+        tmp = w1;
+        w1 = w2;
+        w2 = w;
+        w = tmp;
+        for (i=0; i<n; ++i) {
+            w[i] = (v[i] - oldeps * w1[i] - delta * w2[i]) / gamma;
+            x[i] += phi * w[i];
+        }
+        
+        if (record_residual(stats, phibar / beta1) < 0) {
+            status = -1;
+            break;
+        }
+        stats->iterations++;
+        if (phibar <= rtol * beta1 || beta == 0.0)
+            status = SOLVE_CONVERGED;
+    }
+    
+    free(r1); free(r2); free(y); free(v); free(w); free(w1); free(w2);
+    return status;
+}
+
+// Iterative solution of (sign * M + shift * I) x = b for a symmetric fused
+// operator M (default: the adjacency matrix, so that shift = lambda gives the
+// kernel ridge regression system A + lambda I). method is 'cg' for positive
+// definite systems or 'minres' for indefinite ones. The preconditioner is 
+// None, a vector p (z = p * r) or a callable z = f(r). The iteration runs
+// without the GIL except for calls of a preconditioner callable.
+// Returns (x, info).
+static PyObject *
+AdjacencyCore_solve(AdjacencyCoreObject* self, PyObject* args, PyObject *keywds)
+{
+    int op, status, n, exact = 0, maxiter = 0;
+    double shift = 0.0, sign = 1.0, rtol = 1e-8, tic;
+    const char* name = "adjacency", * method = "cg";
+    PyObject* arg, * x0 = Py_None, * precond = Py_None, * residuals, * info_dict, * result = NULL;
+    PyArrayObject* b = NULL, * x = NULL, * diag = NULL;
+    npy_intp dims[1];
+    Preconditioner P = {0};
+    SolveStats stats = {0};
+    static char *kwlist[] = {"b", "op", "shift", "sign", "method", "rtol", "maxiter", "x0", "preconditioner", "exact", NULL};
+    
+    if (!check_points(self, "AdjacencyCore.solve"))
+        return NULL;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "O|sddsdiOOp", kwlist, &arg, &name, &shift, &sign, 
+                                     &method, &rtol, &maxiter, &x0, &precond, &exact))
+        return NULL;
+    
+    op = operator_op(name);
+    if (op < 0)
+        return NULL;
+    if (op == OP_LAPLACIAN_RW) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.solve requires a symmetric operator");
+        return NULL;
+    }
+    if (strcmp(method, "cg") != 0 && strcmp(method, "minres") != 0) {
+        PyErr_Format(PyExc_ValueError, "Unknown solver '%s' (expected 'cg' or 'minres')", method);
+        return NULL;
+    }
+    
+    // the default 10 n is capped, a solve that needs more iterations is better
+    // served by a preconditioner
+    n = self->n;
+    if (maxiter <= 0)
+        maxiter = n < SOLVE_MAXITER_DEFAULT / 10 ? 10*n : SOLVE_MAXITER_DEFAULT;
+    
+    if (op != OP_ADJACENCY && !compute_degrees(self))
+        return NULL;
+    
+    b = input_vector(arg, n, "AdjacencyCore.solve");
+    if (!b)
+        return NULL;
+    
+    dims[0] = n;
+    if (x0 == Py_None)
+        x = (PyArrayObject*) PyArray_ZEROS(1, dims, NPY_DOUBLE, 0);
+    else
+        x = (PyArrayObject*) PyArray_FROM_OTF(x0, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_ENSURECOPY);
+    if (!x)
+        goto cleanup;
+    if (PyArray_NDIM(x) != 1 || PyArray_DIM(x, 0) != n) {
+        PyErr_Format(PyExc_ValueError, "Initial guess x0 of AdjacencyCore.solve must be a 1D numpy array with %d entries", n);
+        goto cleanup;
+    }
+    
+    P.n = n;
+    if (PyCallable_Check(precond)) {
+        P.func = precond;
+        P.r = (PyArrayObject*) PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+        if (!P.r)
+            goto cleanup;
+    }
+    else if (precond != Py_None) {
+        diag = input_vector(precond, n, "the preconditioner of AdjacencyCore.solve");
+        if (!diag)
+            goto cleanup;
+        P.diag = (const double*) PyArray_DATA(diag);
+    }
+    
+    stats.capacity = maxiter < 255 ? maxiter + 1 : 256;
+    stats.residuals = (double*) malloc(stats.capacity*sizeof(double));
+    if (!stats.residuals) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    
+    if (!acquire_core(self))
+        goto cleanup;
+    
+    // equivalent to Py_BEGIN_ALLOW_THREADS, with the thread state kept in P
+    // so that a preconditioner callable can reacquire the GIL
+    P.save = PyEval_SaveThread();
+    tic = wall_time();
+    if (method[0] == 'c')
+        status = solve_cg(self, op, sign, shift, exact, (double*) PyArray_DATA(b), (double*) PyArray_DATA(x), 
+                          rtol, maxiter, &P, &stats);
+    else
+        status = solve_minres(self, op, sign, shift, exact, (double*) PyArray_DATA(b), (double*) PyArray_DATA(x), 
+                              rtol, maxiter, &P, &stats);
+    tic = wall_time() - tic;
+    PyEval_RestoreThread(P.save);
+    release_core(self);
+    
+    if (status < 0) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    if (status == SOLVE_ERROR)
+        goto cleanup;
+    
+    dims[0] = stats.iterations + 1;
+    residuals = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    if (!residuals)
+        goto cleanup;
+    memcpy(PyArray_DATA((PyArrayObject*) residuals), stats.residuals, dims[0]*sizeof(double));
+    
+    info_dict = Py_BuildValue("{s:i,s:i,s:d,s:O,s:O,s:O,s:d,s:d,s:d,s:N}", 
+                              "iterations", stats.iterations, 
+                              "matvecs", stats.matvecs,
+                              "residual_norm", stats.residuals[stats.iterations],
+                              "converged", status == SOLVE_CONVERGED ? Py_True : Py_False,
+                              "maxiter_reached", status == SOLVE_MAXITER ? Py_True : Py_False,
+                              "breakdown", status == SOLVE_BREAKDOWN ? Py_True : Py_False,
+                              "time_operator", stats.time_operator,
+                              "time_precond", P.time,
+                              "time_total", tic,
+                              "residuals", residuals);
+    if (info_dict) {
+        result = Py_BuildValue("ON", x, info_dict);
+    }
+    
+cleanup:
+    Py_XDECREF(b);
+    Py_XDECREF(x);
+    Py_XDECREF(diag);
+    Py_XDECREF(P.r);
+    free(stats.residuals);
+    
+    return result;
+}
+
+#ifdef BUILD_EIGS
+// ARPACK eigensolver for a symmetric operator M, by default the normalized
+// adjacency matrix N = D^{-1/2} A D^{-1/2}. The iteration computes the largest
+// algebraic eigenvalues of sign * M + shift * I (N + I by default) with the
+// cached degrees and the fused operator. With deflate=True, the known 
+// eigenvector u1 of the extremal eigenvalue (D^{1/2} 1 for N and L_sym, the
+// constant vector for D - A) is removed by Wielandt deflation, i.e. the
+// iteration works on P (sign * M + shift * I) P with P = I - u1 u1^T, and nev
+// further eigenvalues are computed. The shift must be chosen such that the 
+// wanted eigenvalues are positive.
+// Returns (eigenvalues, eigenvectors, info) or (eigenvalues, info).
+static PyObject *
+AdjacencyCore_normalized_eigs(AdjacencyCoreObject* self, PyObject* args, PyObject* keywds) {
+
+    int i, j, op;
+    npy_intp vec_dims[2];
+    PyObject* result = NULL, * eigenvalues, * eigenvectors, * info_dict;
+    double *data, s, nrm;
+    double shift = 1.0, sign = 1.0;
+    double tic, time_total, time_operator = 0.0;
+    const char* name = "normalized";
+    static char *kwlist[] = {"nev", "tol", "maxiter", "ncv", "return_eigenvectors", "deflate", "op", "shift", "sign", NULL};
+
+    if (!check_points(self, "AdjacencyCore.normalized_eigs"))
+        return NULL;
+
+    int n = self->n;    // dimension
+    int nev = 6;        // number of eigenvalues
+    int ncv = 0;        // krylov subspace dimension, default: min(n, max(2*k+1, 20))
+    int maxiter = 0;    // maximum number of iterations
+    double tol = 0.0;   // tolerance
+    int rvecs = 1;      // flag for eigenvector computation
+    int deflate = 0;    // flag for Wielandt deflation of the eigenvalue 1
+    
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "i|diippsdd", kwlist, &nev, &tol, &maxiter, &ncv, &rvecs, &deflate, &name, &shift, &sign))
+        return NULL;
+    
+    op = operator_op(name);
+    if (op < 0)
+        return NULL;
+    if (op == OP_LAPLACIAN_RW) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.normalized_eigs requires a symmetric operator");
+        return NULL;
+    }
+    if (deflate && op == OP_ADJACENCY) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.normalized_eigs cannot deflate the adjacency operator");
+        return NULL;
+    }
+    if (sign == 0.0) {
+        PyErr_SetString(PyExc_ValueError, "AdjacencyCore.normalized_eigs requires a nonzero sign");
+        return NULL;
+    }
+    
+    if (nev <= 0 || nev >= n) {
+        PyErr_Format(PyExc_ValueError, "AdjacencyCore.normalized_eigs requires 0 < nev < %d", n);
+        return NULL;
+    }
+    
+    if (ncv <= 0) {
+        if (nev < 10)
+            ncv = 20;
+        else
+            ncv = 2*nev + 1;
+    }
+    if (ncv > n)
+        ncv = n;
+    
+    if (maxiter <= 0)
+        maxiter = 300; // this is the default from matlab; in scipy, it is n*10
+    
+    if (op != OP_ADJACENCY && !compute_degrees(self))
+        return NULL;
+    
+    // Additional inputs for ARPACK
+    
+    int ido = 0;    // reverse communication flag.
+    int lworkl = ncv*(ncv+8);   // size of array needed internally
+    int info = 0;   // error flag
+    int info_eupd = 0;
+    
+    double* resid = (double*) malloc(n*sizeof(double));
+    double* v = (double*) malloc(n*ncv*sizeof(double));
+    double* workd = (double*) malloc(3*n*sizeof(double));
+    double* workl = (double*) malloc(lworkl*sizeof(double));
+    double* d = (double*) malloc(nev*sizeof(double));
+    double* u1 = deflate ? (double*) malloc(n*sizeof(double)) : NULL;
+    double* tmp = deflate ? (double*) malloc(n*sizeof(double)) : NULL;
+    
+    int iparam[11] = {1,0,maxiter,1,0,0,1,0,0,0,0};
+    int ipntr[11] = {0};
+    int *select = (int*) malloc(ncv*sizeof(int));
+    
+    if (!resid || !v || !workd || !workl || !d || !select || (deflate && (!u1 || !tmp))) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    
+    if (!acquire_core(self))
+        goto cleanup;
+    
+    Py_BEGIN_ALLOW_THREADS
+    
+    time_total = wall_time();
+    
+    if (deflate) {
+        nrm = 0.0;
+        for (i=0; i<n; ++i) {
+            if (op == OP_LAPLACIAN)
+                u1[i] = 1.0;
+            else
+                u1[i] = self->degrees[i] > 0.0 ? sqrt(self->degrees[i]) : 0.0;
+            nrm += u1[i] * u1[i];
+        }
+        nrm = sqrt(nrm);
+        for (i=0; i<n; ++i)
+            u1[i] /= nrm;
+    }
+    
+    while (1) {
+    
+        dsaupd_c(&ido, "I", n, "LA", nev, tol, resid, ncv, v, n, iparam, ipntr, workd, workl, lworkl, &info);
+    
+        if (ido == 1 || ido == -1) {
+            double* x = workd + ipntr[0] - 1;
+            double* y = workd + ipntr[1] - 1;
             
-            if (rvecs) {
-                // Build eigenvector object
-                vec_dims[0] = n;
-                vec_dims[1] = nev;
-                eigenvectors = PyArray_SimpleNew(2, vec_dims, NPY_DOUBLE);
-                PyArray_ENABLEFLAGS((PyArrayObject*) eigenvectors, NPY_OWNDATA);
-                
-                data = (double*) PyArray_DATA((PyArrayObject*) eigenvectors);
-                for (i=0; i<n; ++i) {
-                    for (j=0; j<nev; ++j) {
-                        data[i*nev + j] = v[j*n + i];
-                    }
-                }
-                
-                result = Py_BuildValue("OO", eigenvalues, eigenvectors);
-                Py_DECREF(eigenvalues);
-                Py_DECREF(eigenvectors);
+            tic = wall_time();
+            if (deflate) {
+                s = dot(u1, x, n);
+                for (i=0; i<n; ++i)
+                    tmp[i] = x[i] - s * u1[i];
+                fused_apply(self, op, tmp, y, sign, shift, 0);
+                s = dot(u1, y, n);
+                for (i=0; i<n; ++i)
+                    y[i] -= s * u1[i];
             }
             else {
-                result = eigenvalues;
+                fused_apply(self, op, x, y, sign, shift, 0);
+            }
+            time_operator += wall_time() - tic;
+        }
+        else break;
+    }
+    
+    if (info >= 0)
+        dseupd_c(rvecs, "A", select, d, v, n, 0.0, "I", n, "LA", nev, tol, resid, ncv, v, n, iparam, ipntr, workd, workl, lworkl, &info_eupd);
+    
+    time_total = wall_time() - time_total;
+    
+    Py_END_ALLOW_THREADS
+    release_core(self);
+    
+    if (info < 0) {
+        PyErr_Format(PyExc_RuntimeError, "ARPACK 'dsaupd' failed with error code %d", info);
+        goto cleanup;
+    }
+    if (info_eupd < 0) {
+        PyErr_Format(PyExc_RuntimeError, "ARPACK 'dseupd' failed with error code %d", info_eupd);
+        goto cleanup;
+    }
+    
+    // Iteration statistics; info == 1 means that maxiter was reached
+    info_dict = Py_BuildValue("{s:i,s:i,s:i,s:i,s:O,s:d,s:d}", 
+                              "iterations", iparam[2], 
+                              "matvecs", iparam[8], 
+                              "reorthogonalizations", iparam[10],
+                              "converged", iparam[4],
+                              "maxiter_reached", info == 1 ? Py_True : Py_False,
+                              "time_operator", time_operator,
+                              "time_total", time_total);
+    if (!info_dict)
+        goto cleanup;
+    
+    // Build eigenvalue object
+    vec_dims[0] = nev;
+    eigenvalues = PyArray_SimpleNew(1, vec_dims, NPY_DOUBLE);
+    if (!eigenvalues) {
+        Py_DECREF(info_dict);
+        goto cleanup;
+    }
+    
+    data = (double*) PyArray_DATA((PyArrayObject*) eigenvalues);
+    for (j=0; j<nev; ++j) {
+        data[j] = (d[j] - shift) / sign;
+    }
+    
+    if (rvecs) {
+        // Build eigenvector object
+        vec_dims[0] = n;
+        vec_dims[1] = nev;
+        eigenvectors = PyArray_SimpleNew(2, vec_dims, NPY_DOUBLE);
+        if (!eigenvectors) {
+            Py_DECREF(eigenvalues);
+            Py_DECREF(info_dict);
+            goto cleanup;
+        }
+        
+        data = (double*) PyArray_DATA((PyArrayObject*) eigenvectors);
+        for (i=0; i<n; ++i) {
+            for (j=0; j<nev; ++j) {
+                data[i*nev + j] = v[j*n + i];
             }
         }
         
+        result = Py_BuildValue("OOO", eigenvalues, eigenvectors, info_dict);
+        Py_DECREF(eigenvectors);
+    }
+    else {
+        result = Py_BuildValue("OO", eigenvalues, info_dict);
     }
+    Py_DECREF(eigenvalues);
+    Py_DECREF(info_dict);
     
-    free(d_invsqrt);
+cleanup:
     free(resid);
     free(v);
     free(workd);
     free(workl);
     free(d);
+    free(u1);
+    free(tmp);
     free(select);
     
     return result;
@@ -520,30 +1960,275 @@ AdjacencyCore_normalized_eigs(AdjacencyCoreObject* self, PyObject* args, PyObjec
 #endif
 
 
+// Squared distance between a row of the data, scaled by scale, and a center
+static inline double
+kmeans_distance(const char* row, npy_intp cs, double scale, const double* center, int d)
+{
+    int l;
+    double dist = 0.0;
+    for (l=0; l<d; ++l) {
+        double t = scale * *(const double*) (row + l*cs) - center[l];
+        dist += t * t;
+    }
+    return dist;
+}
+
+// Lloyd's k-means with greedy k-means++ seeding on the rows of an n x d array, read 
+// in place through its strides (no copy of the data). With normalize, every row 
+// is scaled to unit length on the fly, as in spectral clustering (Ng, Jordan & 
+// Weiss, 2001). The assignment step and the center sums are parallelized with 
+// OpenMP, every thread accumulating into its own buffer.
+static PyObject *
+core_kmeans(PyObject* module, PyObject* args, PyObject* keywds)
+{
+    PyObject* arg;
+    PyArrayObject* array, * labels_array = NULL, * centers_array = NULL;
+    int k, d, normalize = 1, maxiter = 300, iter = 0, c, l, t, trials, ok = 1;
+    double tol = 1e-6, inertia = INFINITY, previous, total;
+    unsigned long long seed = 0;
+    uint64_t state;
+    npy_intp i, n, rs, cs, changed, dims[2];
+    npy_intp* labels;
+    double* scale = NULL, * mind = NULL, * centers, * sums = NULL, * counts = NULL;
+    const char* data;
+    
+    static char *kwlist[] = {"U", "k", "maxiter", "tol", "seed", "normalize", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "Oi|idKp", kwlist, &arg, &k, &maxiter, &tol, &seed, &normalize))
+        return NULL;
+    
+    // aligned doubles are used as they are, whatever the memory order
+    array = (PyArrayObject*) PyArray_FROM_OTF(arg, NPY_DOUBLE, NPY_ARRAY_ALIGNED);
+    if (!array)
+        return NULL;
+    if (PyArray_NDIM(array) != 2) {
+        PyErr_SetString(PyExc_ValueError, "kmeans requires a 2D array");
+        Py_DECREF(array);
+        return NULL;
+    }
+    n = PyArray_DIM(array, 0);
+    d = PyArray_DIM(array, 1);
+    if (k < 1 || k > n) {
+        PyErr_Format(PyExc_ValueError, "kmeans: the number of clusters must be between 1 and %ld", (long) n);
+        Py_DECREF(array);
+        return NULL;
+    }
+    data = PyArray_BYTES(array);
+    rs = PyArray_STRIDE(array, 0);
+    cs = PyArray_STRIDE(array, 1);
+    
+    dims[0] = n;
+    labels_array = (PyArrayObject*) PyArray_EMPTY(1, dims, NPY_INTP, 0);
+    dims[0] = k;
+    dims[1] = d;
+    centers_array = (PyArrayObject*) PyArray_ZEROS(2, dims, NPY_DOUBLE, 0);
+    scale = (double*) malloc(n*sizeof(double));
+    mind = (double*) malloc(n*sizeof(double));
+    sums = (double*) malloc(k*d*sizeof(double));
+    counts = (double*) malloc(k*sizeof(double));
+    if (!labels_array || !centers_array || !scale || !mind || !sums || !counts) {
+        if (!PyErr_Occurred())
+            PyErr_NoMemory();
+        ok = 0;
+        goto cleanup;
+    }
+    labels = (npy_intp*) PyArray_DATA(labels_array);
+    centers = (double*) PyArray_DATA(centers_array);
+    state = seed;
+    trials = 2 + (int) log(k);
+    
+    Py_BEGIN_ALLOW_THREADS
+    
+    #pragma omp parallel for
+    for (i=0; i<n; ++i) {
+        double nrm = 0.0;
+        int m;
+        if (normalize) {
+            for (m=0; m<d; ++m) {
+                double t = *(const double*) (data + i*rs + m*cs);
+                nrm += t * t;
+            }
+        }
+        scale[i] = normalize ? (nrm > 0 ? 1.0 / sqrt(nrm) : 0.0) : 1.0;
+    }
+    
+    // greedy k-means++ (Arthur & Vassilvitskii, 2007): every new center is the best 
+    // of 2 + log(k) candidates drawn with probability proportional to the squared 
+    // distance to the nearest center chosen so far
+    i = (npy_intp) ((random_uniform(&state) + 1.0) / 2.0 * n);
+    i = i < n ? i : n-1;
+    for (l=0; l<d; ++l)
+        centers[l] = scale[i] * *(const double*) (data + i*rs + l*cs);
+    total = 0.0;
+    #pragma omp parallel for reduction(+:total)
+    for (i=0; i<n; ++i) {
+        mind[i] = kmeans_distance(data + i*rs, cs, scale[i], centers, d);
+        total += mind[i];
+    }
+    
+    for (c=1; c<k; ++c) {
+        double best_potential = INFINITY, potential, target;
+        npy_intp best = 0, candidate;
+        double* center = centers + c*d;
+        
+        for (t=0; t<trials; ++t) {
+            target = (random_uniform(&state) + 1.0) / 2.0 * total;
+            for (candidate=0; candidate<n-1 && target >= mind[candidate]; ++candidate)
+                target -= mind[candidate];
+            for (l=0; l<d; ++l)
+                center[l] = scale[candidate] * *(const double*) (data + candidate*rs + l*cs);
+            
+            potential = 0.0;
+            #pragma omp parallel for reduction(+:potential)
+            for (i=0; i<n; ++i)
+                potential += fmin(mind[i], kmeans_distance(data + i*rs, cs, scale[i], center, d));
+            if (potential < best_potential) {
+                best_potential = potential;
+                best = candidate;
+            }
+        }
+        
+        for (l=0; l<d; ++l)
+            center[l] = scale[best] * *(const double*) (data + best*rs + l*cs);
+        total = 0.0;
+        #pragma omp parallel for reduction(+:total)
+        for (i=0; i<n; ++i) {
+            mind[i] = fmin(mind[i], kmeans_distance(data + i*rs, cs, scale[i], center, d));
+            total += mind[i];
+        }
+    }
+    
+    for (i=0; i<n; ++i)
+        labels[i] = -1;
+    
+    for (iter=0; iter<maxiter; ++iter) {
+        previous = inertia;
+        inertia = 0.0;
+        changed = 0;
+        memset(sums, 0, k*d*sizeof(double));
+        memset(counts, 0, k*sizeof(double));
+        
+        #pragma omp parallel reduction(+:inertia, changed)
+        {
+            double* local = (double*) calloc(k*(d+1), sizeof(double));
+            npy_intp j;
+            int b;
+            
+            #pragma omp for
+            for (j=0; j<n; ++j) {
+                int best = 0, a, m;
+                double best_dist = INFINITY;
+                for (a=0; a<k; ++a) {
+                    double dist = kmeans_distance(data + j*rs, cs, scale[j], centers + a*d, d);
+                    if (dist < best_dist) {
+                        best_dist = dist;
+                        best = a;
+                    }
+                }
+                changed += labels[j] != best;
+                labels[j] = best;
+                mind[j] = best_dist;
+                inertia += best_dist;
+                if (local) {
+                    for (m=0; m<d; ++m)
+                        local[best*d + m] += scale[j] * *(const double*) (data + j*rs + m*cs);
+                    local[k*d + best] += 1.0;
+                }
+            }
+            
+            #pragma omp critical
+            {
+                if (local) {
+                    for (b=0; b<k*d; ++b)
+                        sums[b] += local[b];
+                    for (b=0; b<k; ++b)
+                        counts[b] += local[k*d + b];
+                } else {
+                    ok = 0;
+                }
+            }
+            free(local);
+        }
+        if (!ok)
+            break;
+        
+        // an empty cluster restarts at the point farthest from its center
+        for (c=0; c<k; ++c) {
+            if (counts[c] > 0) {
+                for (l=0; l<d; ++l)
+                    centers[c*d + l] = sums[c*d + l] / counts[c];
+            } else {
+                npy_intp far = 0;
+                for (i=1; i<n; ++i)
+                    if (mind[i] > mind[far])
+                        far = i;
+                for (l=0; l<d; ++l)
+                    centers[c*d + l] = scale[far] * *(const double*) (data + far*rs + l*cs);
+                mind[far] = 0.0;
+                changed = 1;
+            }
+        }
+        
+        if (changed == 0 || previous - inertia <= tol * inertia) {
+            ++iter;
+            break;
+        }
+    }
+    
+    Py_END_ALLOW_THREADS
+    
+    if (!ok)
+        PyErr_NoMemory();
+    
+cleanup:
+    free(scale);
+    free(mind);
+    free(sums);
+    free(counts);
+    Py_DECREF(array);
+    if (!ok) {
+        Py_XDECREF(labels_array);
+        Py_XDECREF(centers_array);
+        return NULL;
+    }
+    return Py_BuildValue("NNdi", labels_array, centers_array, inertia, iter);
+}
+
+
 static PyMemberDef AdjacencyCore_members[] = {
     {"kernel", T_INT, offsetof(AdjacencyCoreObject, kernel), READONLY, "Kernel function"},
     {"d", T_INT, offsetof(AdjacencyCoreObject, d), READONLY, "Spatial dimension"},
-    {"sigma", T_DOUBLE, offsetof(AdjacencyCoreObject, sigma), READONLY, "Sigma for kernel"},
     {"N", T_INT, offsetof(AdjacencyCoreObject, N), READONLY, "Expansion degree (n in NFFT)"},
     {"p", T_INT, offsetof(AdjacencyCoreObject, p), READONLY, "Smoothness parameter"},
     {"m", T_INT, offsetof(AdjacencyCoreObject, m), READONLY, "Window cutoff parameter"},
     {"eps", T_DOUBLE, offsetof(AdjacencyCoreObject, eps), READONLY, "Outer boundary width"},
     {"NN", T_INT, offsetof(AdjacencyCoreObject, NN), READONLY, "Oversampling expansion degree (default: a power of two with 2*N <= NN < 4*N)"},
-    {"diagonal", T_DOUBLE, offsetof(AdjacencyCoreObject, diagonal), 0, "Value on the diagonal of the adjacency matrix"},
     {"n", T_INT, offsetof(AdjacencyCoreObject, n), READONLY, "Number of points given"},
     {NULL}
 };
 
 static PyMethodDef AdjacencyCore_methods[] = {
     {"apply", (PyCFunction) AdjacencyCore_apply, METH_VARARGS | METH_KEYWORDS, "Approximate a matrix-vector product with the adjacency matrix"},
+    {"apply_normalized", (PyCFunction) AdjacencyCore_apply_normalized, METH_VARARGS | METH_KEYWORDS, "Approximate sign * D^{-1/2} A D^{-1/2} v + shift * v"},
+    {"apply_laplacian", (PyCFunction) AdjacencyCore_apply_laplacian, METH_VARARGS | METH_KEYWORDS, "Approximate sign * L v + shift * v for the Laplacian L of the given kind: 'sym' (I - D^{-1/2} A D^{-1/2}), 'rw' (I - D^{-1} A) or 'unnormalized' (D - A)"},
+    {"apply_block", (PyCFunction) AdjacencyCore_apply_block, METH_VARARGS | METH_KEYWORDS, "Approximate sign * M X + shift * X for the columns of X and the operator M ('adjacency', 'normalized', 'sym', 'rw' or 'unnormalized'), two columns per transform"},
+    {"submatrix", (PyCFunction) AdjacencyCore_submatrix, METH_VARARGS | METH_KEYWORDS, "Exact submatrix A[I, J] of the adjacency matrix (A[I, I] if J is omitted, all rows if I is None), evaluated directly from the kernel"},
+    {"columns", (PyCFunction) AdjacencyCore_columns, METH_VARARGS, "Exact columns A[:, J] of the adjacency matrix"},
+    {"diag", (PyCFunction) AdjacencyCore_diag, METH_NOARGS, "Diagonal of the adjacency matrix"},
+    {"distance_coloring", (PyCFunction) AdjacencyCore_distance_coloring, METH_VARARGS, "Greedy coloring of the nodes such that nodes of equal color are at least the given radius apart"},
+    {"lanczos_norm", (PyCFunction) AdjacencyCore_lanczos_norm, METH_VARARGS | METH_KEYWORDS, "Estimate the spectral norm of a symmetric operator by Lanczos iteration, returns (estimate, lower, upper, matvecs); upper holds with probability at least 1 - delta"},
+    {"solve", (PyCFunction) AdjacencyCore_solve, METH_VARARGS | METH_KEYWORDS, "Solve (sign * M + shift * I) x = b for a symmetric operator M with preconditioned CG or MINRES, returns (x, info)"},
 #ifdef BUILD_EIGS
-    {"normalized_eigs", (PyCFunction) AdjacencyCore_normalized_eigs, METH_VARARGS | METH_KEYWORDS, "Approximate a few eigenvalues of the symmetrically normalized adjacency matrix"},
+    {"normalized_eigs", (PyCFunction) AdjacencyCore_normalized_eigs, METH_VARARGS | METH_KEYWORDS, "Approximate a few eigenvalues of the symmetrically normalized adjacency matrix (or another symmetric operator) with ARPACK, returns (w, U, info)"},
 #endif
     {NULL}
 };
 
 static PyGetSetDef AdjacencyCore_getsetters[] = {
     {"points", (getter) AdjacencyCore_getpoints, (setter) AdjacencyCore_setpoints, "Numpy array of 3D points", NULL},
+    {"sigma", (getter) AdjacencyCore_getsigma, (setter) AdjacencyCore_setsigma, "Sigma for kernel (setting it recomputes only the kernel coefficients, not the nodes)", NULL},
+    {"diagonal", (getter) AdjacencyCore_getdiagonal, (setter) AdjacencyCore_setdiagonal, "Value on the diagonal of the adjacency matrix", NULL},
+    {"degrees", (getter) AdjacencyCore_getdegrees, NULL, "Degree vector A*1 (cached until the points, sigma or the diagonal change)", NULL},
+    {"d_invsqrt", (getter) AdjacencyCore_getd_invsqrt, NULL, "Vector of inverse square roots of the degrees, zero for non-positive degrees (cached)", NULL},
     {NULL}
 };
 
@@ -562,11 +2247,17 @@ static PyTypeObject AdjacencyCoreType = {
     .tp_getset = AdjacencyCore_getsetters,
 };
 
+static PyMethodDef core_methods[] = {
+    {"kmeans", (PyCFunction) core_kmeans, METH_VARARGS | METH_KEYWORDS, "Multithreaded k-means++/Lloyd clustering of the rows of U (optionally normalized to unit length), read in place; returns (labels, centers, inertia, iterations)"},
+    {NULL}
+};
+
 static PyModuleDef fastadjcoremodule = {
     PyModuleDef_HEAD_INIT,
     .m_name = "fastadj.core",
     .m_doc = "Fast multiplication with Gaussian adjacency matrices using NFFT/Fastsum",
     .m_size = -1,
+    .m_methods = core_methods,
 };
 
 
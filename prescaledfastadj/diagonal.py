@@ -0,0 +1,83 @@
+
+import numpy as np
+
+from .info import SolverInfo, StochasticEstimate, timer
+from .slq import rademacher
+
+from warnings import warn
+
+
+
+def diag_inverse(solve, n, num_probes=32, colors=None, block_size=32, rng=None, confidence=0.95):
+    """Stochastic estimate of the diagonal of K^{-1} (Bekas, Kokiopoulou & Saad, 
+    2007) for a symmetric positive definite K, where solve(B) returns K^{-1} B for
+    an n x m block together with the SolverInfo of the solve.
+
+    Without colors, every Rademacher probe v gives the sample v * K^{-1} v of all
+    entries. With colors (an integer color per point such that points of equal
+    color are far apart, e.g. from AdjacencyCore.distance_coloring), every
+    repetition uses one probe per color with random signs on the points of that
+    color and zeros elsewhere (probing, Tang & Saad, 2012). Each entry then
+    receives exactly one sample per repetition, whose error only involves the
+    small entries of K^{-1} between distant points. The signs keep both variants
+    unbiased.
+
+    Every entry needs several samples for its standard error, so at most
+    num_probes // 4 colors can be used. With more colors, plain Hutchinson probes
+    are used instead, with a warning: merging color classes to fit the budget
+    puts nearby points into one class, and the interference of their large
+    entries of K^{-1} makes such probing worse than Hutchinson. The number of
+    solved probe vectors, repetitions times colors, stays within
+    max(num_probes, 2).
+
+    solve may also return an n x m x s array with the solutions of s systems,
+    e.g. for s shifts from multishift_cg; the diagonals of all of them are then
+    estimated from the same probes as an n x s array.
+
+    Probes are solved in blocks of block_size columns and only the running sums
+    are kept. Returns a StochasticEstimate of the diagonal with per-entry
+    standard errors and confidence intervals; its num_probes is the number of
+    samples per entry (repetitions) and num_vectors the number of solved probe
+    vectors."""
+    info = SolverInfo('diag-inverse')
+    tic_total = timer()
+    rng = np.random.default_rng(rng)
+
+    if colors is None:
+        num_colors = 1
+        colors = np.zeros(n, dtype=np.int64)
+    else:
+        colors = np.asarray(colors)
+        colors = np.unique(colors, return_inverse=True)[1].ravel()
+        num_colors = colors.max() + 1
+        if num_colors > max(num_probes // 4, 1):
+            warn("diag_inverse: num_probes={} is too small for probing with {} colors (at most num_probes // 4), "
+                 "using plain Hutchinson probes".format(num_probes, num_colors))
+            num_colors = 1
+            colors = np.zeros(n, dtype=np.int64)
+    repetitions = max(num_probes // num_colors, 2)
+
+    # probe (r, c) carries random signs on the points of color c; since the colors
+    # partition the points, every entry gets exactly one sample per repetition
+    probes = np.tile(np.arange(num_colors), repetitions)
+    total = 0.0
+    total_squares = 0.0
+
+    for start in range(0, len(probes), block_size):
+        batch = probes[start:start+block_size]
+        V = rademacher(rng, n, len(batch)) * (colors[:,None] == batch)
+
+        W, stats = solve(V)
+        info.matvecs += stats.matvecs
+        info.iterations += stats.iterations
+        info.time_operator += stats.time_operator
+
+        samples = V[:,:,None] * W if W.ndim == 3 else V * W
+        total += samples.sum(axis=1)
+        total_squares += (samples**2).sum(axis=1)
+
+    info.converged = True
+    info.time_total = timer() - tic_total
+    result = StochasticEstimate.from_moments(total, total_squares, repetitions, confidence, info)
+    result.num_vectors = len(probes)
+    return result
@@ -0,0 +1,87 @@
+
+import numpy as np
+from scipy.linalg import qr
+
+from .info import SolverInfo, StochasticEstimate, timer
+from .slq import rademacher
+
+
+
+def trace_inv_products(solve, derivatives, n, num_probes=30, method='hutch++', extra_rhs=None,
+                       rng=None, confidence=0.95, probes=None):
+    """Stochastic estimates of tr(K^{-1} dK_i) for a symmetric positive definite K
+    and several symmetric derivative matrices dK_i, from one block solve (two for
+    Hutch++).
+
+    solve(B) must return K^{-1} B for an n x m block, and derivatives is a list
+    of functions V -> dK_i V. Since
+    z^T K^{-1} dK_i z = (K^{-1} z)^T (dK_i z), the solves for the probes are shared
+    by all i; only the derivative products are repeated.
+
+    With method 'hutchinson', all num_probes Rademacher probes go to the plain
+    Hutchinson estimator. With 'hutch++' (Meyer et al., 2021), a third of them
+    sketches the dominant range Q_i = orth(K^{-1} dK_i S) of every traced product,
+    solved in the same block as the probes. A second block solve gives
+    K^{-1} Q_i, so that the traces tr(Q_i^T K^{-1} dK_i Q_i) are computed exactly,
+    and the remaining probes, projected onto the complement of Q_i, estimate
+    the rest. Both parts are unbiased for any Q_i. The sketches cost k solves and
+    2k derivative products per derivative, so with many derivatives the plain
+    estimator is cheaper.
+
+    probes may give the n x m block of Hutchinson probes (e.g. those of another
+    estimate that the traces should be correlated with) instead of drawing them.
+
+    The columns of extra_rhs (e.g. the training targets) are solved in the first
+    block. Returns a StochasticEstimate whose estimate is the vector of traces,
+    and the solutions of extra_rhs (or None)."""
+    info = SolverInfo(method)
+    tic_total = timer()
+    rng = np.random.default_rng(rng)
+    p = len(derivatives)
+
+    def apply(dK, V):
+        tic = timer()
+        D = dK(V)
+        info.time_operator += timer() - tic
+        info.matvecs += V.shape[1]
+        return D
+
+    if method == 'hutch++':
+        k = max(num_probes // 3, 1)
+        S = rng.standard_normal((n, k))
+        G = rademacher(rng, n, max(num_probes - k, 2)) if probes is None else probes
+    elif method == 'hutchinson':
+        k = 0
+        S = np.zeros((n, 0))
+        G = rademacher(rng, n, num_probes) if probes is None else probes
+    else:
+        raise ValueError("Unknown trace estimator '{}' (expected 'hutchinson' or 'hutch++')".format(method))
+
+    # sketches dK_i S and products dK_i G share one call per derivative
+    D = [apply(dK, np.hstack([S, G])) for dK in derivatives]
+    R = np.zeros((n, 0)) if extra_rhs is None else np.reshape(extra_rhs, (n, -1))
+    W = solve(np.hstack([D_i[:, :k] for D_i in D] + [G, R]))
+    s = G.shape[1]
+    WG = W[:, p*k:p*k+s]
+
+    if k > 0:
+        tic = timer()
+        Q = [qr(W[:, i*k:(i+1)*k], mode='economic')[0] for i in range(p)]
+        info.time_orth += timer() - tic
+        WQ = solve(np.hstack(Q))
+
+    samples = np.empty((s, p))
+    for i, dK in enumerate(derivatives):
+        DG = D[i][:, k:]
+        if k > 0:
+            # exact part, and the probes projected onto the complement of Q_i
+            KQ = WQ[:, i*k:(i+1)*k]
+            DQ = apply(dK, Q[i])
+            C = Q[i].T @ G
+            samples[:, i] = np.einsum('ij,ij->', KQ, DQ) + np.einsum('ij,ij->j', WG - KQ @ C, DG - DQ @ C)
+        else:
+            samples[:, i] = np.einsum('ij,ij->j', WG, DG)
+
+    info.converged = True
+    info.time_total = timer() - tic_total
+    return StochasticEstimate(samples, confidence, info), (W[:, p*k+s:] if extra_rhs is not None else None)
@@ -0,0 +1,111 @@
+
+from time import perf_counter as timer
+
+import numpy as np
+from scipy.stats import norm, t
+
+
+
+class SolverInfo:
+    """Iteration statistics of an iterative solver.
+    
+    matvecs          number of operator applications
+    iterations       number of iterations (Lanczos steps or solver iterations)
+    restarts         number of restarts
+    reorth_passes    number of second Gram-Schmidt passes
+    reorth_restarts  number of random vectors drawn after a breakdown
+    time_operator    wall time spent in operator applications (seconds)
+    time_orth        wall time spent in orthogonalization and basis updates
+    time_precond     wall time spent in the preconditioner
+    time_total       total wall time
+    residuals        residual norms of the wanted quantities after every restart
+    converged        whether the requested tolerance has been reached
+    """
+    
+    def __init__(self, method):
+        self.method = method
+        self.matvecs = 0
+        self.iterations = 0
+        self.restarts = 0
+        self.reorth_passes = 0
+        self.reorth_restarts = 0
+        self.time_operator = 0.0
+        self.time_orth = 0.0
+        self.time_precond = 0.0
+        self.time_total = 0.0
+        self.residuals = []
+        self.converged = False
+    
+    def as_dict(self):
+        return dict(self.__dict__)
+    
+    def __repr__(self):
+        return "SolverInfo(method={!r}, matvecs={}, iterations={}, restarts={}, converged={}, time_total={:.3g}s, time_operator={:.3g}s, time_orth={:.3g}s)".format(
+            self.method, self.matvecs, self.iterations, self.restarts, self.converged, 
+            self.time_total, self.time_operator, self.time_orth)
+
+
+
+class TimedOperator:
+    """Wrap an operator such that its applications are counted and timed into a SolverInfo."""
+    
+    def __init__(self, operator, info):
+        self.operator = operator
+        self.info = info
+    
+    def __call__(self, v):
+        tic = timer()
+        w = self.operator(v)
+        self.info.time_operator += timer() - tic
+        self.info.matvecs += 1
+        return w
+
+
+
+class StochasticEstimate:
+    """Result of a randomized (Monte Carlo) estimator.
+    
+    estimate    mean of the samples
+    stderr      standard error of the mean
+    interval    confidence interval (lower, upper) from Student's t distribution with
+                num_probes - 1 degrees of freedom (few probes give wide intervals)
+    confidence  level of the confidence interval
+    num_probes  number of samples
+    samples     the individual samples (None if only their moments were kept)
+    info        SolverInfo with the matvec count and timings
+    """
+    
+    def __init__(self, samples, confidence, info):
+        samples = np.asarray(samples)
+        stderr = samples.std(axis=0, ddof=1) / np.sqrt(len(samples)) if len(samples) > 1 else None
+        self._set(samples.mean(axis=0), stderr, len(samples), confidence, info)
+        self.samples = samples
+    
+    @classmethod
+    def from_moments(cls, total, total_squares, num_probes, confidence, info):
+        """Estimate from the sum and the sum of squares of num_probes samples."""
+        self = cls.__new__(cls)
+        mean = total / num_probes
+        stderr = None
+        if num_probes > 1:
+            var = np.maximum(total_squares - num_probes * mean**2, 0) / (num_probes - 1)
+            stderr = np.sqrt(var / num_probes)
+        self._set(mean, stderr, num_probes, confidence, info)
+        self.samples = None
+        return self
+    
+    def _set(self, estimate, stderr, num_probes, confidence, info):
+        self.estimate = estimate
+        self.stderr = np.inf * np.ones_like(estimate) if stderr is None else stderr
+        self.num_probes = num_probes
+        self.confidence = confidence
+        z = t.ppf(0.5 + confidence / 2, num_probes - 1) if num_probes > 1 else norm.ppf(0.5 + confidence / 2)
+        self.interval = (self.estimate - z * self.stderr, self.estimate + z * self.stderr)
+        self.info = info
+    
+    def __float__(self):
+        return float(self.estimate)
+    
+    def __repr__(self):
+        return "StochasticEstimate(estimate={}, stderr={}, confidence={}, num_probes={}, matvecs={})".format(
+            self.estimate, self.stderr, self.confidence, self.num_probes, self.info.matvecs)
@@ -0,0 +1,82 @@
+
+import numpy as np
+
+from .info import SolverInfo, StochasticEstimate, timer
+from .slicing import chebyshev_moments, jackson_chebyshev_step, jackson_damping
+
+
+
+class SpectralDensity:
+    """Kernel polynomial method (Weisse et al., 2006) estimate of the eigenvalue
+    density of a symmetric n x n operator with spectrum in [lo, hi], from the
+    stochastic Chebyshev moments of the operator mapped to [-1, 1].
+
+    density(x) evaluates the Jackson-damped Chebyshev series of the density
+    (normalized to n eigenvalues), count(a, b) is the StochasticEstimate of the
+    number of eigenvalues in [a, b], and histogram(bins) the estimated counts per
+    bin. All of them reuse the same moments and cost no further products."""
+
+    def __init__(self, moments, n, lo=-1.0, hi=1.0, confidence=0.95, info=None):
+        self.moments = np.asarray(moments)
+        self.n = n
+        self.lo, self.hi = lo, hi
+        self.confidence = confidence
+        self.info = info
+        self.damping = jackson_damping(self.degree)
+
+    @property
+    def degree(self):
+        return self.moments.shape[1] - 1
+
+    @property
+    def num_probes(self):
+        return self.moments.shape[0]
+
+    def _to_unit(self, x):
+        return np.clip((2*np.asarray(x, dtype=float) - self.lo - self.hi) / (self.hi - self.lo), -1, 1)
+
+    def density(self, x):
+        """Estimated number of eigenvalues per unit length at x."""
+        t = self._to_unit(x)
+        theta = np.arccos(np.clip(t, -1 + 1e-12, 1 - 1e-12))
+        coeffs = self.damping * self.moments.mean(axis=0)
+        coeffs[1:] *= 2
+        series = np.cos(np.multiply.outer(theta, np.arange(self.degree+1))) @ coeffs
+        return self.n * series / (np.pi * np.sin(theta)) * 2 / (self.hi - self.lo)
+
+    def count(self, a, b):
+        """StochasticEstimate of the number of eigenvalues in [a, b]."""
+        a_, b_ = self._to_unit([a, b])
+        samples = self.n * self.moments @ jackson_chebyshev_step(a_, b_, self.degree)
+        return StochasticEstimate(samples, self.confidence, self.info)
+
+    def cumulative(self, x):
+        """Estimated number of eigenvalues <= x (vectorized)."""
+        x = np.asarray(x, dtype=float)
+        return np.reshape([self.count(self.lo, xi).estimate for xi in x.ravel()], x.shape)
+
+    def histogram(self, bins=50):
+        """Estimated eigenvalue counts in bins equally spaced bins over [lo, hi], or
+        over the given bin edges. Returns (counts, edges)."""
+        edges = np.linspace(self.lo, self.hi, bins+1) if np.ndim(bins) == 0 else np.asarray(bins, dtype=float)
+        return np.diff(self.cumulative(edges)), edges
+
+    def __repr__(self):
+        return "SpectralDensity(n={}, degree={}, num_probes={}, bounds=[{:.3g}, {:.3g}])".format(
+            self.n, self.degree, self.num_probes, self.lo, self.hi)
+
+
+
+def spectral_density(operator, n, lo=-1.0, hi=1.0, degree=200, num_probes=40, block_size=8,
+                     confidence=0.95, rng=None):
+    """KPM density of states of a symmetric operator applied to n x m blocks whose
+    spectrum lies in [lo, hi]; see SpectralDensity and chebyshev_moments.
+    degree Chebyshev moments cost about degree/2 block applications."""
+    info = SolverInfo('kpm')
+    tic_total = timer()
+    center, half = (hi + lo) / 2, (hi - lo) / 2
+    scaled = lambda V: (operator(V) - center*V) / half
+    moments = chebyshev_moments(scaled, n, degree, num_probes, block_size, rng, info)
+    info.converged = True
+    info.time_total = timer() - tic_total
+    return SpectralDensity(moments, n, lo, hi, confidence, info)
@@ -1,47 +1,107 @@
 
+import os
+import json
+
 import numpy as np
-from scipy.linalg import eigh
+from scipy.linalg import eigh, get_blas_funcs
+
+from .info import SolverInfo, TimedOperator, timer
 
 
 
-def krylov_schur_eigs(operator, n, k=6, tol=0, W=None):
+def krylov_schur_eigs(operator, n, k=6, tol=0, W=None, rng=None, return_info=False, callback=None,
+                      checkpoint=None, checkpoint_every=1):
+    """Largest algebraic eigenvalues of a symmetric operator by the Krylov-Schur 
+    method, optionally deflating the orthonormal columns of W. Returns (w, U), or 
+    (w, U, info) with a SolverInfo if return_info is True. callback(info) is 
+    called after every restart.
+    
+    If checkpoint is the path of a directory, the basis is kept in memory-mapped
+    files there and the iteration state is saved after every checkpoint_every-th
+    restart, so that an interrupted run can be continued with 
+    resume_krylov_schur_eigs."""
     if tol is None or tol <= 0:
         tol = 1e-14
-    max_iter = 300
-    eps = np.finfo(float).eps ** (2/3)
     p = min(max(2*k,20), n)
-    k0 = k
+    m = 0 if W is None else W.shape[1]
+    
+    # basis Q = [W, V] in one column-major buffer, so that the projections
+    # against both are a single BLAS call
+    if checkpoint is not None:
+        ckpt = KrylovSchurCheckpoint(checkpoint, n, m+p, create=True)
+        Q = ckpt.buffer(0)
+    else:
+        ckpt = None
+        Q = np.zeros((n, m+p), order='F')
+    if m > 0:
+        Q[:, :m] = W
+    reorth = CGS2(Q, rng)
     
-    v = np.random.randn(n)
-    if W is not None:
-        v -= W @ (W.T @ v)
+    v = np.empty(n)
+    reorth.rng.standard_normal(out=v)
+    v = reorth.project(v, m)
     v /= np.linalg.norm(v)
     
-    V = np.zeros((n,p))
-    H = np.zeros((p,p))
+    state = dict(k0=k, k=k, p=p, m=m, tol=tol, it=0, H=np.zeros((p,p)), v=v, r_norm=0.0,
+                 just_restarted=False, matvecs=0, iterations=0, restarts=0)
+    
+    return _krylov_schur(operator, state, Q, 0, reorth, ckpt, checkpoint_every, return_info, callback)
+
+
+
+def resume_krylov_schur_eigs(operator, checkpoint, return_info=False, callback=None, checkpoint_every=1):
+    """Continue a krylov_schur_eigs run from the last checkpoint saved in the given
+    directory. The operator must be the same as in the interrupted run; all other 
+    parameters are restored from the checkpoint."""
+    ckpt = KrylovSchurCheckpoint.open(checkpoint)
+    state = ckpt.load()
+    index = state.pop('basis')
+    Q = ckpt.buffer(index)
+    
+    reorth = CGS2(Q)
+    reorth.rng.bit_generator.state = state.pop('rng')
+    
+    return _krylov_schur(operator, state, Q, index, reorth, ckpt, checkpoint_every, return_info, callback)
+
+
+
+def _krylov_schur(operator, state, Q, index, reorth, ckpt, checkpoint_every, return_info, callback):
+    info = SolverInfo('krylov-schur')
+    tic_total = timer()
+    operator = TimedOperator(operator, info)
+    
+    max_iter = 300
+    eps = np.finfo(float).eps ** (2/3)
+    
+    k0, k, p, m, tol = state['k0'], state['k'], state['p'], state['m'], state['tol']
+    H, v, r_norm, just_restarted = state['H'], state['v'], state['r_norm'], state['just_restarted']
+    info.matvecs, info.iterations, info.restarts = state['matvecs'], state['iterations'], state['restarts']
+    
+    V = Q[:, m:]
     d = None
     c = None
-    r_norm = 0
-    just_restarted = False
     
     
-    for it in range(max_iter):
+    for it in range(state['it'], max_iter):
         
         
         for jj in range(0 if it == 0 else k, p):
             V[:,jj] = v
-            r = operator(v)
+            r = np.ascontiguousarray(operator(v), dtype=np.float64)
             alpha = np.dot(v, r)
+            info.iterations += 1
             
+            tic = timer()
             if jj == 0:
                 r -= alpha*v
             elif just_restarted:
-                r -= V[:,:jj+1] @ (V[:,:jj+1].T @ r)
+                r = reorth.project(r, m+jj+1)
                 just_restarted = False
             else:
                 r -= (alpha*v + r_norm * V[:,jj-1])
 
-            v, r_norm = robust_reorth(r, V[:,:jj+1], W)
+            v, r_norm = reorth(r, m+jj+1)
+            info.time_orth += timer() - tic
             if v is None:
                 raise RuntimeError('Krylov-Schur eigenvalue computation: Unable to orthogonalize residual')
             
@@ -54,12 +114,24 @@ def krylov_schur_eigs(operator, n, k=6, tol=0, W=None):
         
         ind = np.argsort(-d)
         
-        converged_mask = abs(r_norm * U[-1, ind[:k0]]) < tol*np.maximum(eps, abs(d[ind[:k0]]))
+        residuals = abs(r_norm * U[-1, ind[:k0]])
+        converged_mask = residuals < tol*np.maximum(eps, abs(d[ind[:k0]]))
         num_converged = converged_mask.sum()
         
+        info.residuals.append(residuals)
+        info.converged = num_converged >= k0
+        info.reorth_passes = reorth.num_passes
+        info.reorth_restarts = reorth.num_restarts_used
+        info.time_total = timer() - tic_total
+        if callback is not None:
+            callback(info)
+        
         if num_converged >= k0 or it == max_iter-1:
             break
         
+        info.restarts += 1
+        tic = timer()
+        
         # Adjust k to prevent stagnating
         k = k0 + min(num_converged, (p - k0) // 2)
         if k == 1 and p > 3:
@@ -68,7 +140,17 @@ def krylov_schur_eigs(operator, n, k=6, tol=0, W=None):
         ind = ind[:k]
         d = d[ind]
         U = U[:,ind]
-        V[:,:k] = V @ U
+        if ckpt is not None and index == ckpt.saved:
+            # keep the checkpointed basis intact and compress into the other buffer
+            index = 1 - index
+            Q_new = ckpt.buffer(index)
+            Q_new[:, :m] = Q[:, :m]
+            Q_new[:, m:m+k] = V @ U
+            Q = reorth.Q = Q_new
+            V = Q[:, m:]
+        else:
+            V[:,:k] = V @ U
+        info.time_orth += timer() - tic
         c = r_norm * U[-1, :]
         
         H = np.zeros((p,p))
@@ -78,48 +160,148 @@ def krylov_schur_eigs(operator, n, k=6, tol=0, W=None):
             H[k,i] = c[i]
             
         just_restarted = True
+        
+        if ckpt is not None and (it+1) % checkpoint_every == 0:
+            ckpt.save(index, dict(k0=k0, k=k, p=p, m=m, tol=tol, it=it+1, H=H, v=v, r_norm=r_norm, 
+                                  just_restarted=just_restarted, matvecs=info.matvecs, 
+                                  iterations=info.iterations, restarts=info.restarts,
+                                  rng=reorth.rng.bit_generator.state))
             
         
     ind = ind[:k0]
-    return d[ind], V @ U[:,ind]
+    w, U = d[ind], V @ U[:,ind]
+    info.time_total = timer() - tic_total
+    
+    if return_info:
+        return w, U, info
+    return w, U
 
 
 
 
-def robust_reorth(x, V, W=None, num_reorth=5, num_restarts=3, tol=1e-10):
-    norm = np.linalg.norm(x)
+class KrylovSchurCheckpoint:
+    """On-disk state of a Krylov-Schur iteration: two memory-mapped basis buffers
+    (basis0.npy, basis1.npy) and the remaining state (state.npz) in a directory.
+    The saved state refers to a basis buffer that is not written to before the 
+    next checkpoint, and state.npz is replaced atomically, so the directory always 
+    holds a consistent state. Apart from page cache, this needs no extra memory."""
     
-    for _ in range(num_reorth):
-        x -= V @ (V.T @ x)
-        if W is not None:
-            x -= W @ (W.T @ x)
+    def __init__(self, path, n, ncols, create=False):
+        os.makedirs(path, exist_ok=True)
+        self.path = path
+        self.shape = (n, ncols)
+        self.buffers = [None, None]
+        self.saved = None
+        self.create = create
         
-        norm_new = np.linalg.norm(x)
-        if norm_new > norm / np.sqrt(2):
-            return x/norm_new, norm_new
-        
-        norm = norm_new
+        # a new run invalidates any previous state in the directory
+        if create and os.path.exists(os.path.join(path, 'state.npz')):
+            os.remove(os.path.join(path, 'state.npz'))
+    
+    @classmethod
+    def open(cls, path):
+        with np.load(os.path.join(path, 'state.npz')) as data:
+            shape = tuple(data['shape'])
+        return cls(path, *shape)
     
+    def buffer(self, index):
+        if self.buffers[index] is None:
+            filename = os.path.join(self.path, 'basis{}.npy'.format(index))
+            if not self.create and os.path.exists(filename):
+                Q = np.load(filename, mmap_mode='r+')
+                if Q.shape != self.shape or not Q.flags.f_contiguous:
+                    raise ValueError("Krylov-Schur checkpoint {} does not match the state".format(filename))
+            else:
+                Q = np.lib.format.open_memmap(filename, mode='w+', dtype=np.float64, 
+                                              shape=self.shape, fortran_order=True)
+            self.buffers[index] = Q
+        return self.buffers[index]
     
-    # cannot reorthogonalize, invariant subspace found
+    def save(self, index, state):
+        self.buffers[index].flush()
+        state = dict(state, basis=index, shape=self.shape, rng=json.dumps(state['rng']))
+        tmp = os.path.join(self.path, 'state.tmp.npz')
+        np.savez(tmp, **state)
+        os.replace(tmp, os.path.join(self.path, 'state.npz'))
+        self.saved = index
     
-    for __ in range(num_restarts):
-        x = np.random.randn(x.size)
-        VTx = V.T @ x
-        # x /= np.linalg.norm(x)
+    def load(self):
+        with np.load(os.path.join(self.path, 'state.npz')) as data:
+            state = {key: data[key] for key in data.files}
         
-        for _ in range(num_reorth):
-            x -= V @ VTx
-            if W is not None:
-                x -= W @ (W.T @ x)
-            x /= np.linalg.norm(x)
-            VTx = V.T @ x
-            
-            if abs(1 - np.linalg.norm(x)) < tol and all(abs(VTx) < tol):
-                return x, 0.0
-    
-    return None, 0.0
+        for key in ('k0', 'k', 'p', 'm', 'it', 'matvecs', 'iterations', 'restarts', 'basis'):
+            state[key] = int(state[key])
+        for key in ('tol', 'r_norm'):
+            state[key] = float(state[key])
+        state['just_restarted'] = bool(state['just_restarted'])
+        state['rng'] = json.loads(str(state['rng']))
+        del state['shape']
         
+        self.saved = state['basis']
+        return state
+
+
+
+
+class CGS2:
+    """Classical Gram-Schmidt with reorthogonalization against the leading
+    columns of a preallocated column-major basis Q = [W, V].
+    
+    A vector is projected at most twice (DGKS criterion). The projections
+    against W and V are fused into one GEMV on Q, using preallocated
+    coefficient storage and in-place updates. The BLAS routines are looked up
+    once per basis; each pass then costs two BLAS-2 calls on the contiguous
+    leading columns, which is small next to the fast summation that produces
+    the vector, so the orthogonalization stays in Python next to the restart
+    and checkpoint logic instead of moving into core.c."""
+    
+    def __init__(self, Q, rng=None, num_restarts=3, tol=1e-10):
+        assert Q.flags.f_contiguous, "CGS2 basis must be stored in column-major order"
+        self.Q = Q
+        self.h = np.zeros(Q.shape[1])
+        self.rng = np.random.default_rng(rng)
+        self.num_restarts = num_restarts
+        self.tol = tol
+        self.num_passes = 0
+        self.num_restarts_used = 0
+        self._gemv, = get_blas_funcs(('gemv',), (Q,))
     
+    def project(self, x, m):
+        # x <- x - Q[:,:m] (Q[:,:m]^T x)
+        if m == 0:
+            return x
+        Qm = self.Q[:, :m]
+        h = self.h[:m]
+        np.dot(Qm.T, x, out=h)
+        return self._gemv(-1.0, Qm, h, beta=1.0, y=x, overwrite_y=True)
     
+    def __call__(self, x, m):
+        """Orthonormalize x against Q[:,:m] in place. Returns the normalized 
+        vector and its norm after projection. If x lies in the span of Q[:,:m], 
+        it is replaced by a random vector orthogonal to Q[:,:m] and the norm 0 
+        is returned. Returns (None, 0) if no such vector can be found."""
+        norm = np.linalg.norm(x)
+        
+        for i in range(2):
+            if i > 0:
+                self.num_passes += 1
+            x = self.project(x, m)
+            norm_new = np.linalg.norm(x)
+            if norm_new > norm / np.sqrt(2):
+                x /= norm_new
+                return x, norm_new
+            norm = norm_new
+        
+        # cannot reorthogonalize, invariant subspace found
+        
+        for __ in range(self.num_restarts):
+            self.num_restarts_used += 1
+            self.rng.standard_normal(out=x)
+            for _ in range(2):
+                x = self.project(x, m)
+                x /= np.linalg.norm(x)
+            
+            if m == 0 or abs(self.Q[:, :m].T @ x).max() < self.tol:
+                return x, 0.0
         
+        return None, 0.0
@@ -0,0 +1,91 @@
+
+import numpy as np
+from scipy.stats import norm
+
+from .diagonal import diag_inverse
+from .info import SolverInfo, timer
+from .multishift import multishift_cg
+
+from warnings import warn
+
+
+
+class LOOScores:
+    """Leave-one-out cross-validation scores of kernel ridge regression for a
+    list of regularization parameters (shifts).
+
+    scores      estimated mean squared LOO error per shift
+    stderr      standard error of the scores due to the stochastic diagonal
+                (delta method, assuming uncorrelated entry errors)
+    interval    confidence interval (lower, upper) of the scores from stderr
+    cv_stderr   standard error of the mean over the n LOO errors, i.e. the
+                statistical uncertainty of the cross-validation itself
+    residuals   n x len(shifts) array of LOO residuals alpha_i / [K^{-1}]_ii
+    alpha       n x len(shifts) array of the weights K^{-1} y
+    diagonal    StochasticEstimate of the diagonals of the inverses
+    info        SolverInfo with the matvec count and timings
+    """
+
+    def __init__(self, shifts, alpha, diagonal, confidence, info):
+        self.shifts = shifts
+        self.alpha = alpha
+        self.diagonal = diagonal
+        self.confidence = confidence
+        self.info = info
+
+        n = alpha.shape[0]
+        d = diagonal.estimate
+        self.residuals = alpha / d
+        squares = self.residuals**2
+        self.scores = squares.mean(axis=0)
+        self.cv_stderr = squares.std(axis=0, ddof=1) / np.sqrt(n)
+        # d score / d d_i = -2 alpha_i^2 / (n d_i^3)
+        self.stderr = np.sqrt(((2 * alpha**2 / (n * d**3))**2 * diagonal.stderr**2).sum(axis=0))
+        z = norm.ppf(0.5 + confidence / 2)
+        self.interval = (self.scores - z * self.stderr, self.scores + z * self.stderr)
+
+    @property
+    def best(self):
+        """Shift with the smallest estimated score."""
+        return self.shifts[np.argmin(self.scores)]
+
+    def __repr__(self):
+        return "LOOScores(shifts={}, scores={}, stderr={}, matvecs={})".format(
+            self.shifts, self.scores, self.stderr, self.info.matvecs)
+
+
+
+def loo_cv(operator, y, shifts, num_probes=32, colors=None, rtol=1e-6, block_size=32, rng=None,
+           confidence=0.95):
+    """Approximate leave-one-out cross-validation of kernel ridge regression with
+    K = A + shift * I for every shift, from the closed form of the LOO residuals
+        y_i - f_{-i}(x_i) = alpha_i / [K^{-1}]_ii,   alpha = K^{-1} y.
+    operator(V) must compute (A + s0 * I) V for n x m blocks, s0 = min(shifts).
+
+    The weights of all shifts come from one multi-shift CG solve, and the
+    diagonals [K^{-1}]_ii of all shifts from the same stochastic probes (see
+    diag_inverse), each block of probes again solved by multi-shift CG, so
+    that a candidate shift costs no operator applications beyond those of the
+    smallest one. Returns LOOScores."""
+    info = SolverInfo('loo-cv')
+    tic_total = timer()
+    shifts = np.atleast_1d(np.asarray(shifts, dtype=float))
+    y = np.asarray(y, dtype=float)
+    n = len(y)
+
+    def solve(B):
+        X, stats = multishift_cg(operator, B, shifts, rtol=rtol, return_info=True)
+        if not stats.converged:
+            warn("loo_cv: multi-shift CG did not converge, largest relative residual {:.3g}".format(stats.residuals[-1].max()))
+        return X, stats
+
+    alpha, stats = solve(y[:,None])
+    alpha = alpha[:,0]
+    diagonal = diag_inverse(solve, n, num_probes, colors, block_size=block_size, rng=rng, confidence=confidence)
+
+    info.matvecs = stats.matvecs + diagonal.info.matvecs
+    info.iterations = stats.iterations + diagonal.info.iterations
+    info.time_operator = stats.time_operator + diagonal.info.time_operator
+    info.converged = True
+    info.time_total = timer() - tic_total
+    return LOOScores(shifts, alpha, diagonal, confidence, info)
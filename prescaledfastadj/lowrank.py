@@ -0,0 +1,59 @@
+
+import numpy as np
+
+
+
+class LowRankOperator:
+    """Rank-k surrogate U diag(w) U^T of a symmetric operator from k of its
+    eigenpairs.
+
+    The eigenvectors are stored once as a C-contiguous k x n array, so that both
+    products U^T X and U Y stream through contiguous memory in a single BLAS
+    matrix-matrix call. Blocks of vectors are processed in batches of batch_size
+    columns to bound the size of the k x batch_size intermediate.
+
+    truncation_error is the caller's estimate of the spectral norm of the
+    discarded part, i.e. of max |lambda_j| over the eigenvalues not in w."""
+
+    def __init__(self, w, U, truncation_error=np.nan, batch_size=256):
+        self.w = np.ascontiguousarray(w, dtype=float)
+        self.Ut = np.ascontiguousarray(np.asarray(U, dtype=float).T)
+        self.truncation_error = truncation_error
+        self.batch_size = batch_size
+
+    @property
+    def n(self):
+        return self.Ut.shape[1]
+
+    @property
+    def k(self):
+        return self.Ut.shape[0]
+
+    @property
+    def shape(self):
+        return (self.n, self.n)
+
+    def apply(self, X, f=None):
+        """Compute U diag(f(w)) U^T X for a vector or an n x m block X. By default
+        f is the identity; e.g. f = lambda w: w**t applies t diffusion steps at once."""
+        X = np.asarray(X, dtype=float)
+        if X.shape[0] != self.n:
+            raise ValueError("LowRankOperator.apply: Expected {} rows, got {}".format(self.n, X.shape[0]))
+        w = self.w if f is None else np.asarray(f(self.w), dtype=float)
+
+        if X.ndim == 1:
+            return self.Ut.T @ (w * (self.Ut @ X))
+
+        Y = np.empty((self.n, X.shape[1]))
+        for j in range(0, X.shape[1], self.batch_size):
+            B = X[:, j:j+self.batch_size]
+            Y[:, j:j+self.batch_size] = self.Ut.T @ (w[:,None] * (self.Ut @ B))
+        return Y
+
+    __call__ = apply
+
+    def __matmul__(self, X):
+        return self.apply(X)
+
+    def __repr__(self):
+        return "LowRankOperator(n={}, k={}, truncation_error={:.3g})".format(self.n, self.k, self.truncation_error)
@@ -0,0 +1,178 @@
+
+import numpy as np
+from scipy.linalg import eigh_tridiagonal, LinAlgError
+
+from .info import SolverInfo, timer
+
+
+
+def _tridiagonal_eigh(alpha, beta):
+    try:
+        return eigh_tridiagonal(alpha, beta)
+    except LinAlgError:
+        return eigh_tridiagonal(alpha, beta, lapack_driver='stev')
+
+
+
+# default memory limit for the Krylov bases of lanczos_matfun (1 GiB)
+BASIS_MEMORY = 2**30
+
+
+
+def lanczos_matfun(operator, V, f, maxiter=100, rtol=1e-8, check_every=5, reorthogonalize=None,
+                   return_info=False, callback=None):
+    """Lanczos approximation f(A) v ~ ||v|| Q_k f(T_k) e_1 of the action of a matrix
+    function on the columns of V for a symmetric operator applied to n x m blocks,
+    operator(W) = A W.
+
+    Every column runs its own Lanczos iteration, all active columns advanced by
+    one block application per step, so f may be a single function of the
+    eigenvalues or a list of them, e.g. [lambda x: np.exp(-t*x) for t in ts], all
+    evaluated on the same bases. Every check_every steps a column stops (a
+    posteriori) when the coefficients f(T_k) e_1 of all functions changed by at
+    most rtol relative to their norm since the last check, or when its Krylov
+    space is exhausted.
+
+    With reorthogonalize, the Krylov basis of every column is kept as a
+    contiguous k x n array and fully reorthogonalized by two passes of classical
+    Gram-Schmidt (matrix-vector products on the stored rows). The bases grow by
+    doubling with the steps actually taken, so they need up to 16 k n bytes per
+    column after k steps, 8 maxiter n m bytes at most. Without it, no basis is
+    stored: the three-term recurrence first runs to convergence for T_k and is
+    then repeated to accumulate Q_k f(T_k) e_1 (two-pass Lanczos), which costs
+    twice the products but only a few vectors per column; the loss of
+    orthogonality delays the convergence but does not spoil the result. By
+    default (None), the bases are stored if they fit into BASIS_MEMORY bytes
+    at maxiter steps, and the two-pass variant is used for larger problems.
+
+    Returns an array shaped like V (a list of them if f is a list), or a pair with
+    a SolverInfo whose residuals are the per-column changes at every check.
+    callback(info) is called after every check."""
+    info = SolverInfo('lanczos-matfun')
+    tic_total = timer()
+
+    V = np.asarray(V, dtype=float)
+    vector = V.ndim == 1
+    Z = V[:,None] if vector else V
+    functions = list(f) if isinstance(f, (list, tuple)) else [f]
+    n, m = Z.shape
+    maxiter = min(maxiter, n)
+    if reorthogonalize is None:
+        reorthogonalize = 8 * maxiter * n * m <= BASIS_MEMORY
+
+    alpha = np.zeros((maxiter, m))
+    beta = np.zeros((maxiter, m))
+    length = np.zeros(m, dtype=int)
+    active = np.ones(m, dtype=bool)
+    bases = [np.empty((min(maxiter, 16), n)) for _ in range(m)] if reorthogonalize else None
+
+    znorm = np.linalg.norm(Z, axis=0)
+    active &= znorm > 0
+    start = np.zeros((n, m), order='F')
+    start[:, active] = Z[:, active] / znorm[active]
+    previous = [None] * m
+    change = np.zeros(m)
+
+    def coefficients(c, k):
+        theta, S = _tridiagonal_eigh(alpha[:k, c], beta[:k-1, c])
+        return [S @ (g(theta) * S[0]) for g in functions]
+
+    def step(Q, Q_prev, a, j):
+        # A q_j minus its components along q_j and q_{j-1} for the columns a
+        tic = timer()
+        W = np.asfortranarray(operator(Q[:, a]))
+        info.time_operator += timer() - tic
+        info.matvecs += len(a)
+        tic = timer()
+        alpha[j, a] = np.einsum('ij,ij->j', Q[:, a], W)
+        W -= Q[:, a] * alpha[j, a]
+        if j > 0:
+            W -= Q_prev[:, a] * beta[j-1, a]
+        info.time_orth += timer() - tic
+        return W
+
+    Q, Q_prev = start.copy(order='F'), np.zeros((n, m), order='F')
+    for j in range(maxiter):
+        a = np.flatnonzero(active)
+        if len(a) == 0:
+            break
+        W = step(Q, Q_prev, a, j)
+        info.iterations += 1
+
+        tic = timer()
+        if reorthogonalize:
+            for i, c in enumerate(a):
+                if j == len(bases[c]):
+                    grown = np.empty((min(2*j, maxiter), n))
+                    grown[:j] = bases[c]
+                    bases[c] = grown
+                B = bases[c][:j+1]
+                B[j] = Q[:, c]
+                w = W[:, i]
+                for _ in range(2):
+                    w -= B.T @ (B @ w)
+        beta[j, a] = np.linalg.norm(W, axis=0)
+        length[a] = j + 1
+
+        # exhausted Krylov spaces are exact; such columns stop right away
+        exhausted = beta[j, a] <= 1e-12 * np.abs(alpha[:j+1, a]).max(axis=0)
+        active[a[exhausted]] = False
+        live = a[~exhausted]
+        Q_prev[:, live] = Q[:, live]
+        Q[:, live] = W[:, ~exhausted] / beta[j, live]
+        info.time_orth += timer() - tic
+
+        if (j+1) % check_every == 0 and j+1 < maxiter:
+            for c in np.flatnonzero(active):
+                coeffs = coefficients(c, j+1)
+                if previous[c] is not None:
+                    diff = max(np.linalg.norm(x - np.pad(p, (0, len(x) - len(p)))) / max(np.linalg.norm(x), 1e-300)
+                               for x, p in zip(coeffs, previous[c]))
+                    change[c] = diff
+                    if diff <= rtol:
+                        active[c] = False
+                previous[c] = coeffs
+            info.residuals.append(change.copy())
+            info.time_total = timer() - tic_total
+            if callback is not None:
+                callback(info)
+
+    info.converged = not active.any()
+
+    # coefficients of every function in the Krylov bases, scaled by ||v||
+    X = [np.zeros((maxiter, m)) for _ in functions]
+    for c in range(m):
+        k = length[c]
+        if k > 0:
+            for Xg, x in zip(X, coefficients(c, k)):
+                Xg[:k, c] = znorm[c] * x
+
+    if reorthogonalize:
+        results = [np.zeros((n, m)) for _ in functions]
+        for c in range(m):
+            k = length[c]
+            for R, Xg in zip(results, X):
+                R[:, c] = bases[c][:k].T @ Xg[:k, c]
+    else:
+        # second pass: the same recurrence regenerates the Lanczos vectors one by one
+        results = [np.zeros((n, m), order='F') for _ in functions]
+        Q, Q_prev = start, np.zeros((n, m), order='F')
+        for j in range(length.max(initial=0)):
+            a = np.flatnonzero(length > j)
+            for R, Xg in zip(results, X):
+                R[:, a] += Q[:, a] * Xg[j, a]
+            a = np.flatnonzero(length > j+1)
+            if len(a) == 0:
+                break
+            W = step(Q, Q_prev, a, j)
+            Q_prev[:, a] = Q[:, a]
+            Q[:, a] = W / beta[j, a]
+
+    if vector:
+        results = [R[:,0] for R in results]
+    result = results if isinstance(f, (list, tuple)) else results[0]
+
+    info.time_total = timer() - tic_total
+    if return_info:
+        return result, info
+    return result
@@ -0,0 +1,112 @@
+
+import numpy as np
+
+from .info import SolverInfo, timer
+
+
+
+def multishift_cg(operator, b, shifts, rtol=1e-8, maxiter=None, return_info=False, callback=None):
+    """Solve (A + shift * I) x = b for all given shifts with a single conjugate
+    gradient iteration (Frommer, 2003). Krylov spaces are shift invariant, so the
+    CG iteration for the smallest shift s0 also yields the iterates of all other
+    shifts by scalar recurrences; only the smallest shift, which is the hardest
+    system, costs operator applications. operator(v) must compute (A + s0 * I) v,
+    where s0 = min(shifts), and every A + shift * I must be positive definite.
+    Preconditioning would break the shift invariance and is not supported.
+
+    If b is an n x m block, the m right-hand sides run independent iterations
+    that are advanced together: operator is then applied to n x k blocks of the
+    columns that are still active, and the solutions form an n x m x len(shifts)
+    array.
+
+    Shifts whose residual ||b - (A + shift * I) x|| <= rtol * ||b|| are frozen.
+    Returns the n x len(shifts) array of solutions, or (X, info) with a
+    SolverInfo whose residuals are the relative residual norms of all shifts
+    per iteration. callback(info) is called after every iteration."""
+    info = SolverInfo('multishift-cg')
+    tic_total = timer()
+
+    b = np.asarray(b, dtype=float)
+    vector = b.ndim == 1
+    B = b[:,None] if vector else b
+    shifts = np.atleast_1d(np.asarray(shifts, dtype=float))
+    (n, m), s = B.shape, len(shifts)
+    if maxiter is None:
+        maxiter = 10*n
+    delta = shifts - shifts.min()
+
+    def apply(P):
+        tic = timer()
+        Q = operator(P[:,0])[:,None] if vector else operator(P)
+        info.time_operator += timer() - tic
+        info.matvecs += P.shape[1]
+        return Q
+
+    bnorm = np.linalg.norm(B, axis=0)
+    X = np.zeros((n, m, s))
+    res = np.ones((m, s))
+    active = np.tile((bnorm > 0)[:,None], (1, s))
+    res[~active] = 0
+    info.residuals.append(res[0].copy() if vector else res.copy())
+
+    R = B.copy()
+    Pshift = np.tile(B[:,:,None], (1, 1, s))
+    Pbase = B.copy()
+    rr = np.einsum('ij,ij->j', R, R)
+    zeta, zeta_old = np.ones((m, s)), np.ones((m, s))
+    alpha_old, beta_old = np.ones(m), np.zeros(m)
+
+    for it in range(maxiter):
+        live = np.flatnonzero(active.any(axis=1))
+        if len(live) == 0:
+            break
+        Q = apply(Pbase[:, live])
+
+        tic = timer()
+        pq = np.einsum('ij,ij->j', Pbase[:, live], Q)
+        broken = pq <= 0
+        if broken.any():
+            active[live[broken]] = False
+            live, Q, pq = live[~broken], Q[:, ~broken], pq[~broken]
+            if len(live) == 0:
+                break
+        alpha = rr[live] / pq
+
+        # shifted coefficients; zeta_s is the ratio of the residual of shift s to
+        # the residual of the base system
+        a = active[live]
+        z, zo = zeta[live], zeta_old[live]
+        ao, bo = alpha_old[live][:,None], beta_old[live][:,None]
+        with np.errstate(divide='ignore', invalid='ignore'):
+            zeta_new = z * zo * ao / (alpha[:,None] * bo * (zo - z) + zo * ao * (1 + delta * alpha[:,None]))
+            alpha_s = np.where(a, alpha[:,None] * zeta_new / z, 0.0)
+        X[:, live] += Pshift[:, live] * alpha_s
+
+        R[:, live] -= Q * alpha
+        rr_new = np.einsum('ij,ij->j', R[:, live], R[:, live])
+        beta = rr_new / rr[live]
+        with np.errstate(divide='ignore', invalid='ignore'):
+            beta_s = beta[:,None] * (zeta_new / z)**2
+        Pshift[:, live] = np.where(a, R[:, live, None] * zeta_new + Pshift[:, live] * beta_s, Pshift[:, live])
+        Pbase[:, live] = R[:, live] + beta * Pbase[:, live]
+
+        zeta_old[live] = np.where(a, z, zo)
+        zeta[live] = np.where(a, zeta_new, z)
+        alpha_old[live], beta_old[live], rr[live] = alpha, beta, rr_new
+        res[live] = np.where(a, np.abs(zeta[live]) * np.sqrt(rr_new)[:,None] / bnorm[live,None], res[live])
+        active[live] &= res[live] > rtol
+        info.time_orth += timer() - tic
+
+        info.iterations += 1
+        info.residuals.append(res[0].copy() if vector else res.copy())
+        info.time_total = timer() - tic_total
+        if callback is not None:
+            callback(info)
+
+    info.converged = bool(np.all(res <= rtol))
+    info.time_total = timer() - tic_total
+
+    X = X[:,0] if vector else X
+    if return_info:
+        return X, info
+    return X
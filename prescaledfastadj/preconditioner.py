@@ -0,0 +1,73 @@
+
+import numpy as np
+from scipy.linalg import cho_factor, cho_solve, eigh
+
+
+
+class WoodburyPreconditioner:
+    """Inverse of the low-rank plus shift approximation L L^T + shift * I of
+    A + shift * I, applied by the Woodbury identity
+
+        (L L^T + shift I)^{-1} r = (r - L (shift I + L^T L)^{-1} L^T r) / shift
+
+    with a Cholesky factorization of the small r x r matrix. One application
+    costs two n x rank products; vectors and n x m blocks are accepted, so the
+    object can be passed as the preconditioner of AdjacencyMatrix.solve for one
+    or many right-hand sides."""
+
+    def __init__(self, L, shift):
+        if shift <= 0:
+            raise ValueError("WoodburyPreconditioner requires a positive shift")
+        self.L = np.asfortranarray(L)
+        self.shift = shift
+        self.factor = cho_factor(shift * np.eye(L.shape[1]) + L.T @ L)
+
+    @property
+    def rank(self):
+        return self.L.shape[1]
+
+    def __call__(self, r):
+        return (r - self.L @ cho_solve(self.factor, self.L.T @ r)) / self.shift
+
+    def __repr__(self):
+        return "WoodburyPreconditioner(n={}, rank={}, shift={:.3g})".format(self.L.shape[0], self.rank, self.shift)
+
+
+
+def pivoted_cholesky(columns, diagonal, rank, tol=1e-8):
+    """Partial pivoted Cholesky factorization A ~ L L^T of a positive semidefinite
+    matrix given by its diagonal and a function columns(indices) returning the
+    n x len(indices) array of the selected columns. Stops after rank steps or
+    when the trace of the remainder drops below tol times the trace of A.
+    Returns L (n x k) and the pivot indices."""
+    d = np.array(diagonal, dtype=float)
+    n = len(d)
+    rank = min(rank, n)
+    L = np.zeros((n, rank), order='F')
+    pivots = []
+    trace = d.sum()
+
+    for k in range(rank):
+        j = int(np.argmax(d))
+        if d[j] <= 0 or d.sum() <= tol * trace:
+            break
+        pivots.append(j)
+        col = columns([j])[:,0] - L[:, :k] @ L[j, :k]
+        L[:,k] = col / np.sqrt(d[j])
+        d -= L[:,k]**2
+        d[j] = 0.0
+
+    return L[:, :len(pivots)], np.array(pivots, dtype=int)
+
+
+
+def nystrom(columns, n, rank, rng=None, tol=1e-10):
+    """Nystrom approximation A ~ C W^+ C^T from rank uniformly sampled columns C
+    with W = C[S, :], returned as L = C U Lambda^{-1/2} from the eigenpairs of W
+    above tol times the largest one, together with the landmark indices."""
+    rng = np.random.default_rng(rng)
+    S = np.sort(rng.choice(n, size=min(rank, n), replace=False))
+    C = columns(S)
+    w, U = eigh(C[S,:])
+    keep = w > tol * w.max()
+    return C @ (U[:, keep] / np.sqrt(w[keep])), S
@@ -0,0 +1,172 @@
+
+import numpy as np
+from scipy.linalg import cholesky, eigh, svd, solve_triangular, LinAlgError
+
+from .info import SolverInfo, timer
+from .lowrank import LowRankOperator
+
+
+
+def _orth_against(Q, Y):
+    # two passes of block Gram-Schmidt against Q, followed by a QR of the remainder
+    for _ in range(2):
+        Y = Y - Q @ (Q.T @ Y)
+    P, R = np.linalg.qr(Y)
+    d = np.abs(np.diag(R))
+    return P[:, d > 1e-12 * max(d.max(initial=0), 1e-300)]
+
+
+
+def randomized_range(operator, n, tol=1e-2, block_size=10, max_rank=500, power_iters=1, rng=None, info=None):
+    """Adaptive randomized range finder (Halko, Martinsson & Tropp, 2011) for a
+    symmetric operator applied to n x m blocks, operator(W) = A W.
+
+    The orthonormal basis Q grows by blocks of block_size Gaussian probes. Every
+    new block is first used to test the current basis: for Gaussian Omega,
+    E ||(I - Q Q^T) A Omega||_F^2 = block_size ||(I - Q Q^T) A||_F^2, so the
+    residual of its products estimates the relative Frobenius error, and the
+    iteration stops once it is below tol (relative to ||A||_F, estimated the
+    same way from the first block) or max_rank is reached. Otherwise the block,
+    refined by power_iters power iterations with reorthogonalization, is appended.
+    Returns (Q, estimated relative error)."""
+    rng = np.random.default_rng(rng)
+    max_rank = min(max_rank, n)
+
+    def apply(W):
+        tic = timer()
+        AW = operator(W)
+        if info is not None:
+            info.time_operator += timer() - tic
+            info.matvecs += W.shape[1]
+            info.iterations += 1
+        return AW
+
+    Q = np.zeros((n, 0))
+    norm = None
+    error = np.inf
+    while True:
+        Y = apply(rng.standard_normal((n, block_size)))
+        R = Y - Q @ (Q.T @ Y)
+        if norm is None:
+            norm = np.linalg.norm(Y) or 1.0
+        error = np.linalg.norm(R) / norm
+        if info is not None:
+            info.residuals.append(error)
+        if error <= tol or Q.shape[1] >= max_rank:
+            break
+
+        tic = timer()
+        P = _orth_against(Q, R)
+        if info is not None:
+            info.time_orth += timer() - tic
+        for _ in range(power_iters):
+            P = _orth_against(Q, apply(P))
+        Q = np.hstack([Q, P[:, :max_rank - Q.shape[1]]])
+
+    return Q, error
+
+
+
+def randomized_eigh(operator, n, tol=1e-2, block_size=10, max_rank=500, power_iters=1, rng=None,
+                    return_info=False):
+    """Randomized low-rank factorization A ~ Q B Q^T = U diag(w) U^T of a symmetric
+    (possibly indefinite) operator, with the basis Q from randomized_range and
+    B = Q^T A Q from one more block product. Eigenpairs of B whose discarded part
+    stays within the tolerance are truncated. Returns a LowRankOperator whose
+    truncation_error is the estimated Frobenius norm of A - U diag(w) U^T (and a
+    SolverInfo)."""
+    info = SolverInfo('randomized-eigh')
+    tic_total = timer()
+    Q, error = randomized_range(operator, n, tol, block_size, max_rank, power_iters, rng, info)
+
+    tic = timer()
+    AQ = operator(Q)
+    info.time_operator += timer() - tic
+    info.matvecs += Q.shape[1]
+
+    tic = timer()
+    B = Q.T @ AQ
+    w, S = eigh((B + B.T) / 2)
+    # keep the largest magnitudes; the dropped ones add to the Frobenius error
+    order = np.argsort(-np.abs(w))
+    w, S = w[order], S[:, order]
+    # ||A||_F^2 = ||Q^T A||_F^2 + ||(I - Q Q^T) A||_F^2 with the relative error estimate of the latter
+    norm = np.linalg.norm(AQ) / np.sqrt(max(1 - error**2, 1e-12))
+    dropped = np.sqrt(np.cumsum(w[::-1]**2))[::-1]
+    budget = np.sqrt(max(tol**2 - error**2, 0)) * norm
+    k = int(np.count_nonzero(dropped > budget))
+    info.time_orth += timer() - tic
+
+    truncation = np.sqrt((error * norm)**2 + (dropped[k]**2 if k < len(w) else 0))
+    info.converged = error <= tol
+    info.time_total = timer() - tic_total
+    result = LowRankOperator(w[:k], Q @ S[:, :k], truncation)
+    return (result, info) if return_info else result
+
+
+
+def randomized_nystrom(operator, n, tol=1e-2, block_size=10, max_rank=500, power_iters=1, rng=None,
+                       return_info=False):
+    """Adaptive randomized Nystrom approximation A ~ (A Omega)(Omega^T A Omega)^+ (A Omega)^T
+    = U diag(w) U^T of a positive semidefinite operator (Tropp et al., 2017), computed
+    stably with a small shift nu. The sketch Omega grows by blocks of block_size: each
+    new Gaussian block first measures the error ||(A - U diag(w) U^T) G|| of the current
+    approximation, then (after power_iters power iterations) joins the sketch, so
+    no products are spent on testing alone. Stops when the estimated relative
+    Frobenius error is below tol or max_rank is reached. Returns a LowRankOperator
+    (and a SolverInfo)."""
+    info = SolverInfo('randomized-nystrom')
+    tic_total = timer()
+    rng = np.random.default_rng(rng)
+    max_rank = min(max_rank, n)
+
+    def apply(W):
+        tic = timer()
+        AW = operator(W)
+        info.time_operator += timer() - tic
+        info.matvecs += W.shape[1]
+        info.iterations += 1
+        return AW
+
+    Omega = np.zeros((n, 0))
+    Y = np.zeros((n, 0))
+    w, U = np.zeros(0), np.zeros((n, 0))
+    norm = None
+    while True:
+        G = rng.standard_normal((n, block_size))
+        AG = apply(G)
+        if norm is None:
+            norm = np.linalg.norm(AG) or 1.0
+        error = np.linalg.norm(AG - U @ (w[:,None] * (U.T @ G))) / norm
+        info.residuals.append(error)
+        if error <= tol or Omega.shape[1] >= max_rank:
+            break
+
+        tic = timer()
+        if power_iters > 0:
+            P = _orth_against(Omega, AG)
+            for _ in range(power_iters - 1):
+                P = _orth_against(Omega, apply(P))
+            P = P[:, :max_rank - Omega.shape[1]]
+            AP = apply(P)
+        else:
+            # the sketch need not be orthonormal; the test block joins as it is
+            P, AP = G[:, :max_rank - Omega.shape[1]], AG[:, :max_rank - Omega.shape[1]]
+        Omega = np.hstack([Omega, P])
+        Y = np.hstack([Y, AP])
+
+        # shifted Cholesky factorization of Omega^T Y_nu (Tropp et al., 2017, Alg. 3)
+        nu = np.sqrt(n) * np.finfo(float).eps * np.linalg.norm(Y, 2)
+        Y_nu = Y + nu * Omega
+        try:
+            C = cholesky((Omega.T @ Y_nu + Y_nu.T @ Omega) / 2)
+        except LinAlgError:
+            raise ValueError("randomized_nystrom: the operator is not positive semidefinite")
+        U, s, _ = svd(solve_triangular(C, Y_nu.T, trans='T').T, full_matrices=False)
+        w = np.maximum(s**2 - nu, 0)
+        info.time_orth += timer() - tic
+
+    info.converged = error <= tol
+    info.time_total = timer() - tic_total
+    result = LowRankOperator(w, U, error * norm / np.sqrt(block_size))
+    return (result, info) if return_info else result
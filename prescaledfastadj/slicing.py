@@ -0,0 +1,209 @@
+
+import numpy as np
+from scipy.linalg import eigh, qr
+
+from .info import SolverInfo, timer
+
+from warnings import warn
+
+
+
+def jackson_chebyshev_step(a, b, degree):
+    """Jackson-damped Chebyshev coefficients of the indicator function of [a, b]
+    within [-1, 1]."""
+    ta, tb = np.arccos(np.clip([a, b], -1, 1))
+    j = np.arange(1, degree+1)
+    c = np.empty(degree+1)
+    c[0] = (ta - tb) / np.pi
+    c[1:] = 2 / (np.pi*j) * (np.sin(j*ta) - np.sin(j*tb))
+    return c * jackson_damping(degree)
+
+
+
+def jackson_damping(degree):
+    """Jackson damping factors g_0, ..., g_degree that suppress the Gibbs
+    oscillations of a truncated Chebyshev series."""
+    alpha = np.pi / (degree+2)
+    j = np.arange(degree+1)
+    return ((1 - j/(degree+2)) * np.sin(alpha) * np.cos(j*alpha) + np.cos(alpha) * np.sin(j*alpha) / (degree+2)) / np.sin(alpha)
+
+
+
+def chebyshev_moments(operator, n, degree=200, num_probes=40, block_size=8, rng=None, info=None):
+    """Stochastic Chebyshev moments z^T T_j(A) z / n, j = 0, ..., degree, of a
+    symmetric operator with spectrum in [-1, 1] applied to n x m blocks, for
+    num_probes Rademacher probes processed in blocks of block_size. Two moments are
+    obtained per application from T_{2j} = 2 T_j^2 - T_0 and
+    T_{2j+1} = 2 T_{j+1} T_j - T_1. Returns the num_probes x (degree+1) array."""
+    rng = np.random.default_rng(rng)
+    moments = np.empty((0, degree+1))
+
+    def apply(V):
+        tic = timer()
+        W = operator(V)
+        if info is not None:
+            info.time_operator += timer() - tic
+            info.matvecs += V.shape[1]
+            info.iterations += 1
+        return W
+
+    while len(moments) < num_probes:
+        Z = rng.choice([-1.0, 1.0], size=(n, min(block_size, num_probes - len(moments))))
+        mu = np.empty((Z.shape[1], degree+1))
+        mu[:,0] = np.einsum('ij,ij->j', Z, Z)
+        T_prev, T = Z, apply(Z)
+        mu[:,1] = np.einsum('ij,ij->j', Z, T)
+        j = 1
+        while True:
+            # T_prev and T hold T_{j-1}(A) Z and T_j(A) Z
+            if 2*j <= degree:
+                mu[:,2*j] = 2 * np.einsum('ij,ij->j', T, T) - mu[:,0]
+            if j > 1:
+                mu[:,2*j-1] = 2 * np.einsum('ij,ij->j', T, T_prev) - mu[:,1]
+            if 2*j+1 > degree:
+                break
+            T_prev, T = T, 2*apply(T) - T_prev
+            j += 1
+        moments = np.vstack([moments, mu / n])
+
+    return moments
+
+
+
+def default_degree(a, b):
+    """Filter degree resolving an interval of width b-a in [-1, 1]."""
+    return int(np.clip(np.ceil(4*np.pi / (b - a)), 20, 1000))
+
+
+
+def _scaled(operator, lo, hi):
+    # maps the spectrum from [lo, hi] to [-1, 1]
+    center, half = (hi + lo) / 2, (hi - lo) / 2
+    return lambda v: (operator(v) - center*v) / half
+
+
+
+def chebyshev_filter(operator, X, coeffs):
+    """Apply sum_j coeffs[j] T_j(A) to the columns of X, where the spectrum of the
+    operator A, applied to n x m blocks, lies in [-1, 1]."""
+    T_prev = X
+    Y = coeffs[0] * X
+    if len(coeffs) == 1:
+        return Y
+    T = operator(X)
+    Y += coeffs[1] * T
+    for c in coeffs[2:]:
+        T, T_prev = 2*operator(T) - T_prev, T
+        Y += c * T
+    return Y
+
+
+
+def eigencount(operator, n, a, b, lo, hi, degree=None, num_vectors=20, rng=None, info=None):
+    """Stochastic estimate of the number of eigenvalues in [a, b] of a symmetric
+    operator applied to n x m blocks whose spectrum lies in [lo, hi], as the
+    Hutchinson trace estimate of a Jackson-Chebyshev approximation of the
+    spectral projector. The degree moments come from degree/2 block products
+    (see chebyshev_moments).
+
+    The standard error only covers the probes. The Jackson smoothing blurs the
+    edges of [a, b] over about pi/degree (in the arccos of the spectrum mapped to
+    [-1, 1]), so clusters of eigenvalues just outside the interval leak into the
+    count and those just inside are partially missed; next to a large cluster
+    this bias exceeds the standard error by far. It is estimated by the change of
+    the count, from the same probes, when the degree is halved, which overstates
+    the bias of the full degree. Returns (estimate, standard error, bias); an
+    interval for the true count must include the bias, e.g. estimate +- (2 *
+    standard error + bias), as estimate +- standard error alone excludes it."""
+    a_, b_ = (2*a - lo - hi) / (hi - lo), (2*b - lo - hi) / (hi - lo)
+    if degree is None:
+        degree = 2*default_degree(a_, b_)
+    moments = n * chebyshev_moments(_scaled(operator, lo, hi), n, degree, num_vectors, num_vectors, rng, info)
+    samples = moments @ jackson_chebyshev_step(a_, b_, degree)
+    coarse = moments[:, :degree//2+1] @ jackson_chebyshev_step(a_, b_, degree//2)
+    stderr = samples.std(ddof=1) / np.sqrt(num_vectors) if num_vectors > 1 else np.inf
+    return samples.mean(), stderr, abs(samples.mean() - coarse.mean())
+
+
+
+def slice_eigs(operator, n, a, b, lo, hi, tol=0, degree=None, count=None, num_vectors=20,
+               maxiter=50, rng=None, return_info=False, callback=None):
+    """All eigenpairs with eigenvalues in [a, b] of a symmetric operator applied to
+    n x m blocks whose spectrum lies in [lo, hi], by subspace iteration with a Jackson-Chebyshev
+    polynomial filter. The subspace size is chosen from the stochastic eigenvalue
+    count (computed with num_vectors probes unless count is given) and enlarged
+    if it turns out to be too small. Returns (w, U) in descending order, or
+    (w, U, info) with a SolverInfo if return_info is True. callback(info) is
+    called after every filter iteration. Warns if the pairs in [a, b] have not
+    converged after maxiter iterations."""
+    if tol is None or tol <= 0:
+        tol = 1e-10
+    info = SolverInfo('chebyshev-filter')
+    tic_total = timer()
+    rng = np.random.default_rng(rng)
+
+    a_, b_ = (2*a - lo - hi) / (hi - lo), (2*b - lo - hi) / (hi - lo)
+    if degree is None:
+        degree = default_degree(a_, b_)
+    coeffs = jackson_chebyshev_step(a_, b_, degree)
+
+    def apply(V):
+        tic = timer()
+        W = operator(V)
+        info.time_operator += timer() - tic
+        info.matvecs += V.shape[1]
+        return W
+
+    scaled = _scaled(apply, lo, hi)
+
+    if count is None:
+        # the subspace is sized for the smoothing bias as well
+        count, _, bias = eigencount(apply, n, a, b, lo, hi, 2*degree, num_vectors, rng)
+        count += bias
+    s = min(n, max(int(np.ceil(1.3*count)) + 8, 10))
+    X = rng.standard_normal((n, s))
+
+    for it in range(maxiter):
+        info.iterations += 1
+        Y = chebyshev_filter(scaled, X, coeffs)
+
+        tic = timer()
+        Q, _ = qr(Y, mode='economic')
+        info.time_orth += timer() - tic
+        AQ = apply(Q)
+
+        tic = timer()
+        H = Q.T @ AQ
+        d, S = eigh((H + H.T) / 2)
+        X = Q @ S
+        residuals = np.linalg.norm(AQ @ S - X * d, axis=0)
+        info.time_orth += timer() - tic
+
+        inside = (d >= a) & (d <= b)
+        info.residuals.append(residuals[inside])
+        info.converged = bool(np.all(residuals[inside] < tol))
+        info.time_total = timer() - tic_total
+        if callback is not None:
+            callback(info)
+
+        if inside.sum() >= s - 2 and s < n:
+            # the slice may hold more eigenvalues than the subspace can capture
+            info.restarts += 1
+            info.converged = False
+            s_new = min(n, 2*s)
+            X = np.hstack([X, rng.standard_normal((n, s_new - s))])
+            s = s_new
+        elif info.converged:
+            break
+
+    if not info.converged:
+        warn("slice_eigs: not converged after {} filter iterations, largest residual {:.3g}".format(
+            info.iterations, residuals[inside].max(initial=0.0)))
+
+    ind = np.flatnonzero(inside)[::-1]
+    w, U = d[ind], X[:,ind]
+    info.time_total = timer() - tic_total
+
+    if return_info:
+        return w, U, info
+    return w, U
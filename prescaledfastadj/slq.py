@@ -0,0 +1,115 @@
+
+import numpy as np
+from scipy.linalg import eigh_tridiagonal, LinAlgError
+from scipy.stats import norm
+
+from .info import SolverInfo, StochasticEstimate, timer
+
+
+
+def rademacher(rng, n, m):
+    """n x m block of independent Rademacher (+-1) probe vectors."""
+    return rng.integers(0, 2, size=(n, m)).astype(float) * 2 - 1
+
+
+
+def lanczos_quadrature(operator, Z, steps, info=None):
+    """Gauss quadrature rules of the spectral measures of the columns of Z.
+
+    Runs one Lanczos iteration per column of Z, all of them advanced together so
+    that every step is a single block application operator(V) of the symmetric
+    operator. Returns a list with the nodes (Ritz values) and weights (squared
+    first components of the Ritz vectors, scaled by ||z||^2) per column, such that
+    z^T f(A) z ~ sum(weights * f(nodes))."""
+    n, m = Z.shape
+    steps = min(steps, n)
+    alpha = np.zeros((steps, m))
+    beta = np.zeros((steps, m))
+    length = np.full(m, steps)
+
+    znorm = np.linalg.norm(Z, axis=0)
+    V = Z / znorm
+    V_prev = np.zeros_like(V)
+    active = np.ones(m, dtype=bool)
+
+    for j in range(steps):
+        tic = timer()
+        W = operator(V)
+        if info is not None:
+            info.time_operator += timer() - tic
+            info.matvecs += m
+            info.iterations += 1
+
+        alpha[j] = np.einsum('ij,ij->j', V, W)
+        W -= V * alpha[j]
+        if j > 0:
+            W -= V_prev * beta[j-1]
+        beta[j] = np.linalg.norm(W, axis=0)
+
+        # columns whose Krylov space is exhausted keep their quadrature rule
+        done = active & (beta[j] <= 1e-12 * np.abs(alpha[:j+1]).max(axis=0))
+        length[done] = j + 1
+        active &= ~done
+        if j == steps-1 or not active.any():
+            break
+
+        V_prev, V = V, np.where(active, W / np.where(beta[j] > 0, beta[j], 1), 0.0)
+
+    rules = []
+    for c in range(m):
+        k = length[c]
+        try:
+            theta, S = eigh_tridiagonal(alpha[:k, c], beta[:k-1, c])
+        except LinAlgError:
+            # the default MRRR driver occasionally fails on strongly graded matrices
+            theta, S = eigh_tridiagonal(alpha[:k, c], beta[:k-1, c], lapack_driver='stev')
+        rules.append((theta, znorm[c]**2 * S[0]**2))
+    return rules
+
+
+
+def slq_trace(operator, n, f, steps=30, rtol=1e-2, atol=0.0, max_probes=200, block_size=8,
+              confidence=0.95, rng=None, callback=None):
+    """Stochastic Lanczos quadrature (Ubaru, Chen & Saad, 2017) estimate of
+    trace(f(A)) for a symmetric operator applied to n x m blocks, operator(V) = A V.
+
+    Rademacher probes are processed in blocks of block_size with a steps-point
+    Lanczos quadrature each. After every block, the probes stop as soon as the
+    half width of the confidence interval is below max(rtol * |estimate|, atol),
+    or when max_probes is reached. Returns a StochasticEstimate.
+    callback(estimate) is called after every block."""
+    info = SolverInfo('slq')
+    tic_total = timer()
+    rng = np.random.default_rng(rng)
+    z = norm.ppf(0.5 + confidence / 2)
+
+    samples = []
+    while len(samples) < max_probes:
+        m = min(block_size, max_probes - len(samples))
+        for theta, weights in lanczos_quadrature(operator, rademacher(rng, n, m), steps, info):
+            samples.append(weights @ f(theta))
+
+        result = StochasticEstimate(samples, confidence, info)
+        info.residuals.append(result.stderr)
+        info.time_total = timer() - tic_total
+        if callback is not None:
+            callback(result)
+        if len(samples) > 1 and z * result.stderr <= max(rtol * abs(result.estimate), atol):
+            info.converged = True
+            break
+
+    return result
+
+
+
+def slq_logdet(operator, n, steps=30, rtol=1e-2, atol=0.0, max_probes=200, block_size=8,
+               confidence=0.95, rng=None, callback=None):
+    """Stochastic Lanczos quadrature estimate of log det(A) = trace(log(A)) for a
+    symmetric positive definite operator applied to blocks; see slq_trace."""
+    def log(theta):
+        if theta.min() <= 0:
+            raise ValueError("slq_logdet: the operator is not positive definite (Ritz value {:.3g})".format(theta.min()))
+        return np.log(theta)
+
+    return slq_trace(operator, n, log, steps=steps, rtol=rtol, atol=atol, max_probes=max_probes,
+                     block_size=block_size, confidence=confidence, rng=rng, callback=callback)
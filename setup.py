@@ -14,15 +14,28 @@ include_dirs = [os.path.join(nfft_base, 'include'),
 
 library_dirs = [os.path.join(nfft_base, 'julia', 'fastsum')]
 
+library_names = ['fastsumjulia']
+
 macros = [('MAJOR_VERSION', '0'), ('MINOR_VERSION', '2')]
 
+# optional native ARPACK eigensolver backend (arpack-ng with its C interface)
+arpack_base = os.environ.get('ARPACK_BASE')
+if arpack_base is not None:
+    include_dirs += [os.path.join(arpack_base, 'include', 'arpack'),
+                     os.path.join(arpack_base, 'include')]
+    library_dirs += [os.path.join(arpack_base, 'lib')]
+    library_names += ['arpack']
+    macros += [('BUILD_EIGS', None)]
+
 # C extension prescaledfastadj.core
 core_ext = Extension('prescaledfastadj.core',
     define_macros = macros,
     include_dirs = include_dirs,
-    libraries = ['fastsumjulia'],
+    libraries = library_names,
 	library_dirs = library_dirs,
     runtime_library_dirs = library_dirs,
+    extra_compile_args = ['-fopenmp'],
+    extra_link_args = ['-fopenmp'],
     sources = ['prescaledfastadj/core.c'])
 
 # run setup
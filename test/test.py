@@ -39,7 +39,7 @@ adj_gauss = prescaledfastadj.AdjacencyMatrix(points, np.sqrt(2)*scaledsigma, ker
 
 print("Setup done")
 
-degrees_gauss = adj_gauss.apply(np.ones(n))
+degrees_gauss = adj_gauss.degrees
 
 print("Avg/min/max degree:", degrees_gauss.mean(), degrees_gauss.min(), degrees_gauss.max())
 
@@ -58,7 +58,7 @@ w_gauss, U_gauss = adj_gauss.normalized_eigs(numev)
 time_eigs_gauss = timer() - tic
 print("Time for eigenvalue computation: {} seconds".format(time_eigs_gauss))
 
-d_invsqrt_gauss = 1 / np.sqrt(adj_gauss.apply(np.ones(n)))
+d_invsqrt_gauss = adj_gauss.d_invsqrt
 
 for i in range(w_gauss.size):
 	res_gauss = np.linalg.norm(d_invsqrt_gauss * adj_gauss.apply(d_invsqrt_gauss * U_gauss[:,i]) - U_gauss[:,i] * w_gauss[i])
@@ -72,7 +72,7 @@ adj_der = prescaledfastadj.AdjacencyMatrix(points, np.sqrt(2)*scaledsigma, kerne
 
 print("Setup done")
 
-degrees_der = (2/sigma)*adj_der.apply(np.ones(n))
+degrees_der = (2/sigma)*adj_der.degrees
 
 print("Avg/min/max degree:", degrees_der.mean(), degrees_der.min(), degrees_der.max())
 
@@ -91,7 +91,7 @@ w_der, U_der = adj_der.normalized_eigs(numev)
 time_eigs_der = timer() - tic
 print("Time for eigenvalue computation: {} seconds".format(time_eigs_der))
 
-d_invsqrt_der = 1 / np.sqrt(adj_der.apply(np.ones(n)))
+d_invsqrt_der = adj_der.d_invsqrt
 
 for i in range(w_der.size):
 	res_der = np.linalg.norm(d_invsqrt_der * adj_der.apply(d_invsqrt_der * U_der[:,i]) - U_der[:,i] * w_der[i])
@@ -105,7 +105,7 @@ adj_matern = prescaledfastadj.AdjacencyMatrix(points, scaledsigma, kernel=3, set
 
 print("Setup done")
 
-degrees_matern = adj_matern.apply(np.ones(n))
+degrees_matern = adj_matern.degrees
 
 print("Avg/min/max degree:", degrees_matern.mean(), degrees_matern.min(), degrees_matern.max())
 
@@ -124,7 +124,7 @@ w_matern, U_matern = adj_matern.normalized_eigs(numev)
 time_eigs_matern = timer() - tic
 print("Time for eigenvalue computation: {} seconds".format(time_eigs_matern))
 
-d_invsqrt_matern = 1 / np.sqrt(adj_matern.apply(np.ones(n)))
+d_invsqrt_matern = adj_matern.d_invsqrt
 
 for i in range(w_matern.size):
 	res_matern = np.linalg.norm(d_invsqrt_matern * adj_matern.apply(d_invsqrt_matern * U_matern[:,i]) - U_matern[:,i] * w_matern[i])
@@ -138,7 +138,7 @@ adj_dermat = prescaledfastadj.AdjacencyMatrix(points, scaledsigma, kernel=4, set
 
 print("Setup done")
 
-degrees_dermat = adj_dermat.apply(np.ones(n))
+degrees_dermat = adj_dermat.degrees
 
 print("Avg/min/max degree:", degrees_dermat.mean(), degrees_dermat.min(), degrees_dermat.max())
 
@@ -157,8 +157,260 @@ w_dermat, U_dermat = adj_dermat.normalized_eigs(numev)
 time_eigs_dermat = timer() - tic
 print("Time for eigenvalue computation: {} seconds".format(time_eigs_dermat))
 
-d_invsqrt_dermat = 1 / np.sqrt(adj_dermat.apply(np.ones(n)))
+d_invsqrt_dermat = adj_dermat.d_invsqrt
 
 for i in range(w_dermat.size):
 	res_dermat = np.linalg.norm(d_invsqrt_dermat * adj_dermat.apply(d_invsqrt_dermat * U_dermat[:,i]) - U_dermat[:,i] * w_dermat[i])
 	print("Eigenvalue #{}: {:.4f} - Residual: {:.4e}".format(i, w_dermat[i], res_dermat))
+
+#################################################################################
+
+# Dense reference checks: a small problem whose matrices are formed explicitly
+
+n_small = 400
+sigma_small = 0.05
+
+print("\nDense reference checks with n = {}!".format(n_small))
+
+x_small = np.random.randn(n_small, d)
+points_small = x_small - np.mean(x_small, axis=0)
+points_small = points_small / np.max(np.abs(points_small), axis=0) * 0.25 / scaling
+
+adj_small = prescaledfastadj.AdjacencyMatrix(points_small, sigma_small, kernel=1, setup='default', diagonal=1.0)
+
+# Gaussian kernel exp(-r^2/sigma^2) on the prescaled points, as evaluated by the core
+P_small = adj_small.scaled_points
+A_small = np.exp(-((P_small[:,None,:] - P_small[None,:,:])**2).sum(axis=2) / adj_small.scaled_sigma**2)
+np.fill_diagonal(A_small, adj_small.diagonal)
+deg_small = A_small.sum(axis=1)
+N_small = A_small / np.sqrt(np.outer(deg_small, deg_small))
+w_dense, U_dense = np.linalg.eigh(N_small)
+w_dense, U_dense = w_dense[::-1], U_dense[:,::-1]
+I_small = np.eye(n_small)
+v_small = np.random.randn(n_small)
+V_small = np.random.randn(n_small, 5)
+
+def relerr(x, y):
+	return np.linalg.norm(x - y) / np.linalg.norm(y)
+
+print("Degrees relative error: {:.3e}".format(relerr(adj_small.degrees, deg_small)))
+print("D^(-1/2) relative error: {:.3e}".format(relerr(adj_small.d_invsqrt, 1/np.sqrt(deg_small))))
+adj_small.sigma = 1.5*sigma_small
+print("Degrees after changing sigma, relative error: {:.3e}".format(
+	relerr(adj_small.degrees, (A_small**(1/1.5**2)).sum(axis=1))))
+adj_small.sigma = sigma_small
+
+print("\nFused normalized operator:")
+print("D^(-1/2) A D^(-1/2) v relative error: {:.3e}".format(relerr(adj_small.apply_normalized(v_small), N_small @ v_small)))
+print("-N v + 2 v relative error: {:.3e}".format(
+	relerr(adj_small.apply_normalized(v_small, 2.0, -1.0), -N_small @ v_small + 2*v_small)))
+
+print("\nLaplacian operators:")
+laplacians_small = {'sym': I_small - N_small, 'rw': I_small - A_small / deg_small[:,None],
+                    'unnormalized': np.diag(deg_small) - A_small}
+for kind, L in laplacians_small.items():
+	print("{} Laplacian relative error: {:.3e}".format(kind, relerr(adj_small.apply_laplacian(v_small, kind), L @ v_small)))
+
+print("\nCGS2 reorthogonalization:")
+Q_cgs = np.zeros((n_small, 21), order='F')
+cgs = prescaledfastadj.krylovschur.CGS2(Q_cgs, rng=0)
+for j in range(21):
+	# nearly dependent vectors need the second pass
+	x_cgs = Q_cgs[:, :j] @ np.random.randn(j) + 1e-10*np.random.randn(n_small) if j > 0 else np.random.randn(n_small)
+	Q_cgs[:, j], _ = cgs(x_cgs, j)
+print("Orthogonality error ||Q^T Q - I||: {:.3e}".format(np.linalg.norm(Q_cgs.T @ Q_cgs - np.eye(21))))
+w_small, U_small = adj_small.normalized_eigs(numev)
+print("Largest eigenvalues, max error: {:.3e}".format(np.abs(w_small - w_dense[:numev]).max()))
+print("Eigenvectors, orthogonality error: {:.3e}".format(np.linalg.norm(U_small.T @ U_small - np.eye(numev))))
+
+print("\nLanczos norm bounds:")
+for op, M in (('sym', laplacians_small['sym']), ('adjacency', A_small), ('normalized', N_small)):
+	nrm_small, lower_small, upper_small, matvecs_small = adj_small.norm_bounds(op, rtol=1e-3, maxiter=200)
+	nrm_dense = np.linalg.norm(M, 2)
+	print("{}: lower {:.6f} <= norm {:.6f} <= upper {:.6f}: {} (estimate {:.6f}, {} matvecs)".format(op,
+		lower_small, nrm_dense, upper_small, lower_small <= nrm_dense*(1 + 1e-8) and nrm_dense <= upper_small,
+		nrm_small, matvecs_small))
+print("Normalized Laplacian norm relative error: {:.3e}".format(
+	abs(adj_small.normalized_laplacian_norm() - np.linalg.norm(laplacians_small['sym'], 2)) / np.linalg.norm(laplacians_small['sym'], 2)))
+
+print("\nARPACK backend:")
+if prescaledfastadj.has_arpack():
+	w_arpack, U_arpack, info_arpack = adj_small.normalized_eigs(numev, method='arpack', return_info=True)
+	print("Largest eigenvalues, max error: {:.3e} ({} matvecs, converged: {})".format(
+		np.abs(w_arpack - w_dense[:numev]).max(), info_arpack.matvecs, info_arpack.converged))
+else:
+	print("Not built, skipped")
+
+print("\nEigensolver telemetry:")
+w_small, U_small, info_small = adj_small.normalized_eigs(numev, return_info=True)
+print("{} matvecs, {} restarts, {} residual records, converged: {}".format(
+	info_small.matvecs, info_small.restarts, len(info_small.residuals), info_small.converged))
+print("Max residual ||N u - w u||: {:.3e}".format(np.linalg.norm(N_small @ U_small - U_small * w_small, axis=0).max()))
+
+print("\nCheckpoint and resume:")
+import tempfile
+
+class Interrupt(Exception):
+	pass
+
+def interrupt(info):
+	if info.restarts >= 2:
+		raise Interrupt()
+
+with tempfile.TemporaryDirectory() as checkpoint_small:
+	try:
+		adj_small.normalized_eigs(numev, tol=1e-12, callback=interrupt, checkpoint=checkpoint_small)
+		print("Finished before the interruption")
+	except Interrupt:
+		print("Interrupted after 2 restarts")
+	w_resumed, U_resumed = adj_small.resume_normalized_eigs(checkpoint_small)
+print("Resumed eigenvalues, max error: {:.3e}".format(np.abs(w_resumed - w_dense[:numev]).max()))
+
+print("\nSpectrum slicing:")
+for a, b in ((0.2, 0.6), (0.05, 0.3)):
+	count_small, stderr_small, bias_small = adj_small.normalized_eigencount(a, b)
+	print("Eigenvalues in [{}, {}]: {} (estimate {:.2f} +- {:.2f}, bias {:.2f})".format(a, b,
+		np.count_nonzero((w_dense >= a) & (w_dense <= b)), count_small, stderr_small, bias_small))
+w_slice, U_slice = adj_small.normalized_eigs_interval(0.2, 1.0)
+w_slice_dense = w_dense[w_dense >= 0.2]
+print("Eigenvalues in [0.2, 1]: {} of {}, max error: {:.3e}".format(len(w_slice), len(w_slice_dense),
+	np.abs(w_slice - w_slice_dense).max() if len(w_slice) == len(w_slice_dense) else np.inf))
+
+print("\nLow-rank surrogate:")
+low_rank_small = adj_small.low_rank_operator(numev - 1)
+R_small = N_small - low_rank_small @ I_small
+print("Truncation error {:.4f} >= ||N - U diag(w) U^T|| = {:.4f}: {}".format(low_rank_small.truncation_error,
+	np.linalg.norm(R_small, 2), low_rank_small.truncation_error >= np.linalg.norm(R_small, 2) * (1 - 1e-6)))
+print("Diffusion N^3 V relative error on the range of U: {:.3e}".format(relerr(low_rank_small.apply(V_small, lambda w: w**3),
+	U_dense[:,:numev-1] @ (w_dense[:numev-1,None]**3 * (U_dense[:,:numev-1].T @ V_small)))))
+
+print("\nNative CG and MINRES:")
+K_small = A_small + 0.1*I_small
+x_cg, info_cg = adj_small.solve(v_small, 0.1, return_info=True)
+print("CG relative error: {:.3e} ({} iterations)".format(relerr(x_cg, np.linalg.solve(K_small, v_small)), info_cg.iterations))
+x_minres = adj_small.solve(v_small, -0.5, op='normalized', method='minres')
+print("MINRES (indefinite) relative error: {:.3e}".format(relerr(x_minres, np.linalg.solve(N_small - 0.5*I_small, v_small))))
+
+print("\nBlock operators and block CG:")
+for kind, M in [('normalized', N_small)] + list(laplacians_small.items()):
+	print("Block {} relative error: {:.3e}".format(kind, relerr(adj_small.apply_block(V_small, kind), M @ V_small)))
+X_cg, info_block = adj_small.solve(V_small, 0.1, return_info=True)
+print("Block CG relative error: {:.3e} ({} iterations, {} matvecs)".format(
+	relerr(X_cg, np.linalg.solve(K_small, V_small)), info_block.iterations, info_block.matvecs))
+
+print("\nMulti-shift CG:")
+shifts_small = np.array([0.05, 0.1, 1.0, 10.0])
+X_shifts, info_shifts = adj_small.solve_shifts(v_small, shifts_small, return_info=True)
+for j, s in enumerate(shifts_small):
+	print("Shift {}: relative error {:.3e}".format(s, relerr(X_shifts[:,j], np.linalg.solve(A_small + s*I_small, v_small))))
+print("{} matvecs for {} shifts".format(info_shifts.matvecs, len(shifts_small)))
+
+print("\nPivoted Cholesky and Nystrom preconditioners:")
+x_plain, info_plain = adj_small.solve(v_small, 1e-3, return_info=True)
+for method in ('pivoted-cholesky', 'nystrom'):
+	preconditioner_small = adj_small.preconditioner(1e-3, rank=50, method=method, seed=0)
+	x_pre, info_pre = adj_small.solve(v_small, 1e-3, preconditioner=preconditioner_small, return_info=True)
+	print("{}: relative error {:.3e}, {} iterations (unpreconditioned: {})".format(method,
+		relerr(x_pre, np.linalg.solve(A_small + 1e-3*I_small, v_small)), info_pre.iterations, info_plain.iterations))
+
+print("\nExact submatrices:")
+rows_small, cols_small = np.arange(0, n_small, 7), np.arange(3, n_small, 5)
+print("A[I, J] error: {:.3e}".format(np.abs(adj_small.submatrix(rows_small, cols_small) - A_small[np.ix_(rows_small, cols_small)]).max()))
+print("A[I, I] error: {:.3e}".format(np.abs(adj_small.submatrix(rows_small) - A_small[np.ix_(rows_small, rows_small)]).max()))
+print("diag(A) error: {:.3e}".format(np.abs(adj_small.diag() - np.diag(A_small)).max()))
+
+print("\nStochastic Lanczos quadrature:")
+logdet_small = adj_small.logdet(0.1, seed=0)
+logdet_dense = np.linalg.slogdet(K_small)[1]
+print("log det(A + 0.1 I) = {:.4f}, estimate {:.4f}, interval [{:.4f}, {:.4f}] ({} matvecs)".format(logdet_dense,
+	logdet_small.estimate, logdet_small.interval[0], logdet_small.interval[1], logdet_small.info.matvecs))
+
+print("\nGaussian process gradient:")
+y_small = np.sin(10*P_small[:,0]) + 0.1*np.random.randn(n_small)
+
+def log_likelihood_small(sigma, noise):
+	A = np.exp(-((P_small[:,None,:] - P_small[None,:,:])**2).sum(axis=2) / (adj_small.scaling_factor*sigma)**2)
+	K = A + noise*I_small
+	return -0.5*y_small @ np.linalg.solve(K, y_small) - 0.5*np.linalg.slogdet(K)[1]
+
+h_small = 1e-6
+gradient_dense = np.array([
+	(log_likelihood_small(sigma_small + h_small, 0.1) - log_likelihood_small(sigma_small - h_small, 0.1)) / (2*h_small),
+	(log_likelihood_small(sigma_small, 0.1 + h_small) - log_likelihood_small(sigma_small, 0.1 - h_small)) / (2*h_small)])
+for method in ('hutch++', 'hutchinson'):
+	gradient_small = adj_small.gp_gradient(y_small, 0.1, num_probes=60, method=method, seed=0)
+	print("{}: gradient {}, estimate {} +- {} ({} matvecs)".format(method, gradient_dense, gradient_small.estimate,
+		gradient_small.stderr, gradient_small.info.matvecs))
+
+print("\nDiagonal of the inverse:")
+diag_dense = np.diag(np.linalg.inv(K_small))
+num_colors_small = adj_small.core.distance_coloring(adj_small.probing_radius() * adj_small.scaling_factor).max() + 1
+for coloring, num_probes in ((True, 64), (False, 64), (True, 4*num_colors_small), (False, 4*num_colors_small)):
+	diag_small = adj_small.diag_inverse(0.1, num_probes=num_probes, coloring=coloring, seed=0)
+	print("Coloring {}: max relative error {:.3e}, coverage of the intervals {:.2f}, {} probe vectors".format(coloring,
+		np.abs(diag_small.estimate - diag_dense).max() / diag_dense.max(),
+		np.mean((diag_small.interval[0] <= diag_dense) & (diag_dense <= diag_small.interval[1])), diag_small.num_vectors))
+
+print("\nAdditive Gaussian process:")
+windows_small = [[0, 1], [2]]
+gp_small = prescaledfastadj.additive_gp(points_small, y_small, windows_small, sigma=sigma_small, noise=0.1,
+                                        logdet_probes=64)
+K_additive = 0.1*I_small
+for A in gp_small.matrices:
+	P = A.scaled_points
+	K_additive += np.exp(-((P[:,None,:] - P[None,:,:])**2).sum(axis=2) / A.scaled_sigma**2)
+nll_small, _ = gp_small.objective()
+print("Negative log likelihood {:.4f}, estimate {:.4f}".format(
+	0.5*y_small @ np.linalg.solve(K_additive, y_small) + 0.5*np.linalg.slogdet(K_additive)[1], nll_small))
+result_small = gp_small.fit(maxiter=20)
+print("Fit: {} ({} evaluations, line search failed: {})".format(result_small.message, result_small.evaluations,
+	result_small.line_search_failed))
+
+print("\nMatrix functions:")
+from scipy.linalg import expm
+L_sym = laplacians_small['sym']
+for reorthogonalize in (True, False):
+	E_small = adj_small.matfun_apply(lambda x: np.exp(-2*x), V_small, op='sym', reorthogonalize=reorthogonalize)
+	print("exp(-2 L) V relative error (reorthogonalize {}): {:.3e}".format(reorthogonalize,
+		relerr(E_small, expm(-2*L_sym) @ V_small)))
+w_K, U_K = np.linalg.eigh(K_small)
+print("(A + 0.1 I)^(-1/2) v relative error: {:.3e}".format(relerr(
+	adj_small.matfun_apply(lambda x: 1/np.sqrt(x), v_small, shift=0.1), U_K @ (U_K.T @ v_small / np.sqrt(w_K)))))
+
+print("\nKernel polynomial method:")
+density_small = adj_small.normalized_density(seed=0)
+for a, b in ((-1.0, 1.0), (0.1, 1.0), (0.2, 0.6)):
+	count_small = density_small.count(a, b)
+	print("Eigenvalues in [{}, {}]: {}, estimate {:.2f} +- {:.2f}".format(a, b,
+		np.count_nonzero((w_dense >= a) & (w_dense <= b)), count_small.estimate, count_small.stderr))
+
+print("\nRandomized low-rank factorizations:")
+for method in ('eigh', 'nystrom'):
+	F_small, info_F = adj_small.randomized_low_rank(tol=1e-2, method=method, seed=0, return_info=True)
+	print("{}: rank {}, relative Frobenius error {:.3e} (estimated {:.3e}, {} matvecs)".format(method, F_small.k,
+		np.linalg.norm(A_small - F_small @ I_small) / np.linalg.norm(A_small),
+		F_small.truncation_error / np.linalg.norm(A_small), info_F.matvecs))
+
+print("\nLeave-one-out cross-validation:")
+loo_small = adj_small.loo_cv(y_small, shifts_small, num_probes=64, seed=0)
+for j, s in enumerate(shifts_small):
+	Kinv = np.linalg.inv(A_small + s*I_small)
+	score_dense = np.mean(((Kinv @ y_small) / np.diag(Kinv))**2)
+	print("Shift {}: score {:.4e}, estimate {:.4e} +- {:.1e}".format(s, score_dense, loo_small.scores[j], loo_small.stderr[j]))
+
+print("\nLabel propagation:")
+classes_small = (P_small[:,0] > 0).astype(int)
+labels_small = np.where(np.arange(n_small) % 10 == 0, classes_small, -1)
+F_labels = (labels_small[:,None] == np.arange(2)).astype(float)
+scores_small = adj_small.label_propagation(labels_small, tau=10.0)
+print("Scores relative error: {:.3e}, accuracy {:.3f}".format(
+	relerr(scores_small, np.linalg.solve(I_small + 10.0*L_sym, F_labels)), np.mean(scores_small.argmax(axis=1) == classes_small)))
+
+print("\nSpectral clustering:")
+labels_clustering, stats_clustering = adj_small.spectral_clustering(4)
+# the result must be a fixed point of Lloyd's iteration on the dense eigenvectors
+U_rows = U_dense[:,:4] / np.linalg.norm(U_dense[:,:4], axis=1)[:,None]
+centers_small = np.array([U_rows[labels_clustering == c].mean(axis=0) for c in range(4)])
+nearest_small = ((U_rows[:,None,:] - centers_small[None,:,:])**2).sum(axis=2).argmin(axis=1)
+print("Labels agreeing with the nearest dense center: {:.3f} (inertia {:.4f}, {} iterations)".format(
+	np.mean(nearest_small == labels_clustering), stats_clustering['inertia'], stats_clustering['iterations']))